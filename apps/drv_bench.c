@@ -0,0 +1,646 @@
+/*
+ * drv_bench: latency and throughput benchmark of the drivers in this repo
+ *
+ * tests (any number of them, or "all"):
+ *  led-write    write "1"/"0" alternately to an LED node (leds_driver)
+ *  led-read     read the cached brightness from the LED sysfs attribute
+ *  ioctl        MYDEV_IOC_OP with a NOP on /dev/mydev (char, class or misc driver)
+ *  poll-wakeup  one thread writes the LED, the others sleep in poll() on their own fd of it,
+ *               the latency is from before the write() to the poller running again
+ *  stream       writers and readers moving blocks through the /dev/mydev ring (char/class driver)
+ *  key-irq      flips the pull of a simulated key line (gpio-sim, -k) and reads the event from
+ *               /dev/hellokeys, reported twice: up to the irq timestamp and up to read() returning
+ *
+ * every thread runs -n operations and times each of them, the report has ops/sec over the wall
+ * time of the test and p50/p99/p999/max of the per operation latency (all threads together).
+ * -t runs the test on N threads at once to see the contention, by default each thread opens
+ * its own fd, -s makes them share one.
+ *
+ * see BENCH_README for building and running it.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <libgen.h>
+#include <sys/ioctl.h>
+
+#include "../helloworld_char_driver/mydev.h"
+#include "../platformDevice_module/hellokeys.h"
+
+enum fmt { FMT_TEXT, FMT_CSV, FMT_JSON };
+
+struct config {
+	const char *led;		/* LED node */
+	char led_attr[256];		/* its brightness attribute */
+	const char *mydev;
+	const char *keys;
+	const char *key_pull;		/* gpio-sim pull attribute of the key line */
+	long iterations;
+	int threads;
+	int shared_fd;
+	size_t block;
+	enum fmt fmt;
+};
+
+struct result {
+	const char *test;
+	int threads;
+	long ops;
+	long errors;
+	double seconds;
+	double bytes;
+	uint64_t p50, p99, p999, max;
+};
+
+struct worker {
+	struct config *cfg;
+	int fd;
+	int id;
+	uint64_t *lat;		/* one sample per op, preallocated */
+	long ops;
+	long errors;
+	double bytes;
+	void *shared;		/* test specific */
+};
+
+static struct config cfg = {
+	.led = "/dev/ledred",
+	.mydev = "/dev/mydev",
+	.keys = "/dev/hellokeys",
+	.iterations = 100000,
+	.threads = 1,
+	.block = 65536,
+	.fmt = FMT_TEXT,
+};
+
+static int results_printed;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int open_or_die(const char *path, int flags)
+{
+	int fd = open(path, flags);
+
+	if (fd < 0) {
+		fprintf(stderr, "drv_bench: open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	return fd;
+}
+
+/* ---- tests, one op each, returns bytes moved or -1 ---- */
+
+static long op_led_write(struct worker *w, long i)
+{
+	return write(w->fd, (i & 1) ? "0" : "1", 1);
+}
+
+static long op_led_read(struct worker *w, long i)
+{
+	char buf[8];
+
+	return pread(w->fd, buf, sizeof(buf), 0);
+}
+
+static long op_ioctl(struct worker *w, long i)
+{
+	struct mydev_op op = { .code = MYDEV_OP_NOP };
+
+	return ioctl(w->fd, MYDEV_IOC_OP, &op);
+}
+
+typedef long (*op_fn)(struct worker *w, long i);
+
+static void *run_ops(void *arg)
+{
+	struct worker *w = arg;
+	op_fn fn = (op_fn)w->shared;
+	uint64_t t0;
+	long i, ret;
+
+	for (i = 0; i < w->cfg->iterations; i++) {
+		t0 = now_ns();
+		ret = fn(w, i);
+		w->lat[w->ops++] = now_ns() - t0;
+		if (ret < 0)
+			w->errors++;
+		else
+			w->bytes += ret;
+	}
+	return NULL;
+}
+
+/* poll-wakeup: a ping-pong between the writer (worker 0) and the pollers */
+struct pingpong {
+	atomic_uint_fast64_t t_write;
+	atomic_int acked;
+	atomic_int round;
+};
+
+static void *run_poller(void *arg)
+{
+	struct worker *w = arg;
+	struct pingpong *pp = w->shared;
+	struct pollfd pfd = { .fd = w->fd, .events = POLLIN };
+	char buf[16];
+	long i;
+
+	/*
+	 * the first read of a fresh fd returns at once, after that reads at offset 0 only return
+	 * changes (further on is EOF, so always pread() from 0)
+	 */
+	if (pread(w->fd, buf, sizeof(buf), 0) < 0)
+		w->errors++;
+	atomic_fetch_add(&pp->acked, 1);
+
+	for (i = 0; i < w->cfg->iterations; i++) {
+		/* a missed wakeup is an error, still acked so the writer goes on */
+		if (poll(&pfd, 1, 1000) != 1) {
+			w->errors++;
+		} else {
+			w->lat[w->ops++] = now_ns() - atomic_load(&pp->t_write);
+			if (pread(w->fd, buf, sizeof(buf), 0) < 0)
+				w->errors++;
+		}
+		atomic_fetch_add(&pp->acked, 1);
+	}
+	return NULL;
+}
+
+/* the LED is on when its brightness attribute is not 0, off if it can't be read */
+static int led_is_on(void)
+{
+	char buf[16] = "";
+	int fd, ret;
+
+	fd = open(cfg.led_attr, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	ret = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	return ret > 0 && atoi(buf) != 0;
+}
+
+static void *run_pinger(void *arg)
+{
+	struct worker *w = arg;
+	struct pingpong *pp = w->shared;
+	int pollers = w->cfg->threads;
+	/* every write has to be a change, whatever the test before left the LED at */
+	int on = led_is_on();
+	long i;
+
+	for (i = 0; i < w->cfg->iterations; i++) {
+		/* every poller is back in poll() before the next change */
+		while (atomic_load(&pp->acked) < pollers * (i + 1))
+			;
+		on = !on;
+		atomic_store(&pp->t_write, now_ns());
+		if (write(w->fd, on ? "1" : "0", 1) < 0)
+			w->errors++;
+		w->ops++;
+	}
+	return NULL;
+}
+
+/* stream: writers and readers of the ring, every reader takes as much as one writer puts in */
+static void *run_stream_writer(void *arg)
+{
+	struct worker *w = arg;
+	char *buf = w->shared;
+	size_t left, off;
+	ssize_t ret;
+	long i;
+
+	for (i = 0; i < w->cfg->iterations; i++) {
+		left = w->cfg->block;
+		off = 0;
+		while (left) {
+			ret = write(w->fd, buf + off, left);
+			if (ret < 0) {
+				w->errors++;
+				return NULL;
+			}
+			off += ret;
+			left -= ret;
+		}
+	}
+	return NULL;
+}
+
+static void *run_stream_reader(void *arg)
+{
+	struct worker *w = arg;
+	char *buf = w->shared;
+	double quota = (double)w->cfg->iterations * w->cfg->block;
+	size_t len;
+	uint64_t t0;
+	ssize_t ret;
+
+	while (w->bytes < quota) {
+		/* never more than the share left, the other readers of the ring would wait for it forever */
+		len = quota - w->bytes < w->cfg->block ? (size_t)(quota - w->bytes) : w->cfg->block;
+		t0 = now_ns();
+		ret = read(w->fd, buf, len);
+		if (w->ops < w->cfg->iterations * 4)
+			w->lat[w->ops++] = now_ns() - t0;
+		if (ret <= 0) {
+			w->errors++;
+			return NULL;
+		}
+		w->bytes += ret;
+	}
+	return NULL;
+}
+
+/* ---- running and reporting ---- */
+
+/*
+ * the first %d in path is replaced by n, nothing else in it is special (path is no format string,
+ * a name with another % in it stays as it is)
+ */
+static void node_name(char *node, size_t size, const char *path, int n)
+{
+	const char *p = strstr(path, "%d");
+
+	if (p)
+		snprintf(node, size, "%.*s%d%s", (int)(p - path), path, n, p + 2);
+	else
+		snprintf(node, size, "%s", path);
+}
+
+/*
+ * a %d in path is replaced by the thread number (stream: the reader/writer pair), so every thread
+ * can get its own device instance, eg. -m /dev/mydev%d
+ */
+static struct worker *workers_new(int n, long samples, const char *path, int flags)
+{
+	struct worker *w = calloc(n, sizeof(*w));
+	int shared = -1, i;
+	char node[256];
+
+	if (!w)
+		exit(1);
+	for (i = 0; i < n; i++) {
+		w[i].cfg = &cfg;
+		w[i].id = i;
+		w[i].lat = malloc(samples * sizeof(uint64_t));
+		if (!w[i].lat)
+			exit(1);
+		if (cfg.shared_fd) {
+			if (shared < 0)
+				shared = open_or_die(path, flags);
+			w[i].fd = shared;
+		} else {
+			node_name(node, sizeof(node), path, i % cfg.threads);
+			w[i].fd = open_or_die(node, flags);
+		}
+	}
+	return w;
+}
+
+static void workers_free(struct worker *w, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (!cfg.shared_fd || i == 0)
+			close(w[i].fd);
+		free(w[i].lat);
+	}
+	free(w);
+}
+
+static void run_threads(struct worker *w, int n, void *(*fn)(void *))
+{
+	pthread_t *tid = calloc(n, sizeof(*tid));
+	int i;
+
+	for (i = 0; i < n; i++)
+		pthread_create(&tid[i], NULL, fn, &w[i]);
+	for (i = 0; i < n; i++)
+		pthread_join(tid[i], NULL);
+	free(tid);
+}
+
+/* merges the latency samples of the workers in [first, first + n) */
+static void summarize(struct result *r, struct worker *w, int first, int n)
+{
+	uint64_t *all;
+	long total = 0, k = 0;
+	int i;
+
+	for (i = first; i < first + n; i++)
+		total += w[i].ops;
+	all = malloc((total ? total : 1) * sizeof(uint64_t));
+	if (!all)
+		exit(1);
+	for (i = first; i < first + n; i++) {
+		memcpy(all + k, w[i].lat, w[i].ops * sizeof(uint64_t));
+		k += w[i].ops;
+		r->errors += w[i].errors;
+		r->bytes += w[i].bytes;
+	}
+	qsort(all, total, sizeof(uint64_t), cmp_u64);
+
+	r->ops = total;
+	if (total) {
+		r->p50 = all[total / 2];
+		r->p99 = all[(long)(total * 0.99)];
+		r->p999 = all[(long)(total * 0.999)];
+		r->max = all[total - 1];
+	}
+	free(all);
+}
+
+static void report(const struct result *r)
+{
+	double ops_s = r->seconds > 0 ? r->ops / r->seconds : 0;
+	double mb_s = r->seconds > 0 ? r->bytes / r->seconds / 1e6 : 0;
+
+	switch (cfg.fmt) {
+	case FMT_CSV:
+		if (!results_printed)
+			printf("test,threads,ops,errors,seconds,ops_per_sec,mb_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+		printf("%s,%d,%ld,%ld,%.6f,%.0f,%.1f,%llu,%llu,%llu,%llu\n", r->test, r->threads, r->ops,
+		       r->errors, r->seconds, ops_s, mb_s, (unsigned long long)r->p50,
+		       (unsigned long long)r->p99, (unsigned long long)r->p999, (unsigned long long)r->max);
+		break;
+	case FMT_JSON:
+		printf("%s\n  {\"test\": \"%s\", \"threads\": %d, \"ops\": %ld, \"errors\": %ld, "
+		       "\"seconds\": %.6f, \"ops_per_sec\": %.0f, \"mb_per_sec\": %.1f, "
+		       "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+		       results_printed ? "," : "[", r->test, r->threads, r->ops, r->errors, r->seconds,
+		       ops_s, mb_s, (unsigned long long)r->p50, (unsigned long long)r->p99,
+		       (unsigned long long)r->p999, (unsigned long long)r->max);
+		break;
+	default:
+		printf("%-12s threads %-3d ops %-9ld errors %-5ld %10.0f ops/s", r->test, r->threads,
+		       r->ops, r->errors, ops_s);
+		if (r->bytes && !strcmp(r->test, "stream"))
+			printf(" %8.1f MB/s", mb_s);
+		printf("  p50 %llu p99 %llu p999 %llu max %llu ns\n", (unsigned long long)r->p50,
+		       (unsigned long long)r->p99, (unsigned long long)r->p999, (unsigned long long)r->max);
+	}
+	results_printed++;
+}
+
+static void bench_ops(const char *test, const char *path, int flags, op_fn fn)
+{
+	struct result r = { .test = test, .threads = cfg.threads };
+	struct worker *w = workers_new(cfg.threads, cfg.iterations, path, flags);
+	uint64_t t0;
+	int i;
+
+	for (i = 0; i < cfg.threads; i++)
+		w[i].shared = (void *)fn;
+	t0 = now_ns();
+	run_threads(w, cfg.threads, run_ops);
+	r.seconds = (now_ns() - t0) / 1e9;
+
+	summarize(&r, w, 0, cfg.threads);
+	r.bytes = 0;
+	report(&r);
+	workers_free(w, cfg.threads);
+}
+
+static void bench_poll_wakeup(void)
+{
+	struct result r = { .test = "poll-wakeup", .threads = cfg.threads };
+	struct pingpong pp = { 0 };
+	struct worker *w;
+	pthread_t pinger;
+	int saved = cfg.shared_fd, i;
+	uint64_t t0;
+
+	/* every poller needs its own fd, the change is tracked per open file */
+	cfg.shared_fd = 0;
+	w = workers_new(cfg.threads + 1, cfg.iterations, cfg.led, O_RDWR);
+	cfg.shared_fd = saved;
+	for (i = 0; i <= cfg.threads; i++)
+		w[i].shared = &pp;
+
+	t0 = now_ns();
+	pthread_create(&pinger, NULL, run_pinger, &w[cfg.threads]);
+	run_threads(w, cfg.threads, run_poller);
+	pthread_join(pinger, NULL);
+	r.seconds = (now_ns() - t0) / 1e9;
+
+	summarize(&r, w, 0, cfg.threads);
+	r.errors += w[cfg.threads].errors;
+	r.bytes = 0;
+	report(&r);
+	workers_free(w, cfg.threads + 1);
+}
+
+static void bench_stream(void)
+{
+	struct result r = { .test = "stream", .threads = cfg.threads };
+	long samples = cfg.iterations * 4;
+	struct worker *w;
+	pthread_t *tid;
+	uint64_t t0;
+	int n = cfg.threads, i;
+
+	/* readers first (0..n-1), then the writers (n..2n-1) */
+	w = workers_new(2 * n, samples, cfg.mydev, O_RDWR);
+	tid = calloc(2 * n, sizeof(*tid));
+	for (i = 0; i < 2 * n; i++) {
+		w[i].shared = malloc(cfg.block);
+		if (!w[i].shared)
+			exit(1);
+		memset(w[i].shared, i, cfg.block);
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < 2 * n; i++)
+		pthread_create(&tid[i], NULL, i < n ? run_stream_reader : run_stream_writer, &w[i]);
+	for (i = 0; i < 2 * n; i++)
+		pthread_join(tid[i], NULL);
+	r.seconds = (now_ns() - t0) / 1e9;
+
+	for (i = n; i < 2 * n; i++)
+		r.errors += w[i].errors;
+	summarize(&r, w, 0, n);
+	report(&r);
+
+	for (i = 0; i < 2 * n; i++)
+		free(w[i].shared);
+	free(tid);
+	workers_free(w, 2 * n);
+}
+
+/*
+ * key-irq: one thread, a line of gpio-sim doesn't get faster with more of them. the keys are
+ * active low, pull-down is a press. the fifo is drained first so every read() is our edge
+ */
+static void bench_key_irq(void)
+{
+	struct result irq = { .test = "key-irq", .threads = 1 };
+	struct result rd = { .test = "key-read", .threads = 1 };
+	struct hellokeys_event ev;
+	struct worker w[2] = { 0 };
+	int pull, keys, flags;
+	uint64_t t0, start;
+	long i;
+
+	if (!cfg.key_pull) {
+		fprintf(stderr, "drv_bench: key-irq needs the pull attribute of a gpio-sim line (-k)\n");
+		exit(2);
+	}
+	pull = open_or_die(cfg.key_pull, O_WRONLY);
+	keys = open_or_die(cfg.keys, O_RDONLY);
+	for (i = 0; i < 2; i++) {
+		w[i].lat = malloc(cfg.iterations * sizeof(uint64_t));
+		if (!w[i].lat)
+			exit(1);
+	}
+
+	if (pwrite(pull, "pull-up", 7, 0) < 0)
+		w[0].errors++;
+	usleep(10000);
+	flags = fcntl(keys, F_GETFL);
+	fcntl(keys, F_SETFL, flags | O_NONBLOCK);
+	while (read(keys, &ev, sizeof(ev)) > 0)
+		;
+	fcntl(keys, F_SETFL, flags);
+
+	start = now_ns();
+	for (i = 0; i < cfg.iterations; i++) {
+		t0 = now_ns();
+		if (pwrite(pull, (i & 1) ? "pull-up" : "pull-down", (i & 1) ? 7 : 9, 0) < 0 ||
+		    read(keys, &ev, sizeof(ev)) != sizeof(ev)) {
+			w[0].errors++;
+			break;
+		}
+		w[1].lat[w[1].ops++] = now_ns() - t0;
+		w[0].lat[w[0].ops++] = ev.timestamp_ns > t0 ? ev.timestamp_ns - t0 : 0;
+	}
+	irq.seconds = rd.seconds = (now_ns() - start) / 1e9;
+
+	summarize(&irq, w, 0, 1);
+	summarize(&rd, w, 1, 1);
+	rd.errors = irq.errors;
+	report(&irq);
+	report(&rd);
+
+	close(pull);
+	close(keys);
+	free(w[0].lat);
+	free(w[1].lat);
+}
+
+static void run_test(const char *test)
+{
+	if (!strcmp(test, "led-write"))
+		bench_ops(test, cfg.led, O_WRONLY, op_led_write);
+	else if (!strcmp(test, "led-read"))
+		bench_ops(test, cfg.led_attr, O_RDONLY, op_led_read);
+	else if (!strcmp(test, "ioctl"))
+		bench_ops(test, cfg.mydev, O_RDWR, op_ioctl);
+	else if (!strcmp(test, "poll-wakeup"))
+		bench_poll_wakeup();
+	else if (!strcmp(test, "stream"))
+		bench_stream();
+	else if (!strcmp(test, "key-irq"))
+		bench_key_irq();
+	else {
+		fprintf(stderr, "drv_bench: unknown test %s\n", test);
+		exit(2);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: drv_bench [options] test...\n"
+		"tests: led-write led-read ioctl poll-wakeup stream key-irq all\n"
+		"  -l path   LED node (default /dev/ledred)\n"
+		"  -a path   LED brightness attribute (default /sys/class/misc/<led>/brightness)\n"
+		"  -m path   mydev node (default /dev/mydev)\n"
+		"  -e path   hellokeys node (default /dev/hellokeys)\n"
+		"  -k path   pull attribute of the gpio-sim line of a key, key-irq only\n"
+		"  -n count  operations per thread (default 100000)\n"
+		"  -t count  threads (default 1)\n"
+		"  -s        threads share one fd\n"
+		"  -b bytes  block size of the stream test (default 65536)\n"
+		"  -f fmt    text, csv or json (default text)\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static const char * const all[] = { "led-write", "led-read", "ioctl", "poll-wakeup", "stream" };
+	const char *attr = NULL;
+	char led[256];
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "l:a:m:e:k:n:t:sb:f:h")) != -1) {
+		switch (opt) {
+		case 'l': cfg.led = optarg; break;
+		case 'a': attr = optarg; break;
+		case 'm': cfg.mydev = optarg; break;
+		case 'e': cfg.keys = optarg; break;
+		case 'k': cfg.key_pull = optarg; break;
+		case 'n': cfg.iterations = atol(optarg); break;
+		case 't': cfg.threads = atoi(optarg); break;
+		case 's': cfg.shared_fd = 1; break;
+		case 'b': cfg.block = strtoul(optarg, NULL, 0); break;
+		case 'f':
+			if (!strcmp(optarg, "csv"))
+				cfg.fmt = FMT_CSV;
+			else if (!strcmp(optarg, "json"))
+				cfg.fmt = FMT_JSON;
+			else if (strcmp(optarg, "text"))
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind >= argc || cfg.iterations <= 0 || cfg.threads <= 0 || !cfg.block)
+		usage();
+
+	if (attr) {
+		snprintf(cfg.led_attr, sizeof(cfg.led_attr), "%s", attr);
+	} else {
+		snprintf(led, sizeof(led), "%s", cfg.led);
+		snprintf(cfg.led_attr, sizeof(cfg.led_attr), "/sys/class/misc/%s/brightness", basename(led));
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (!strcmp(argv[i], "all")) {
+			for (unsigned int k = 0; k < sizeof(all) / sizeof(all[0]); k++)
+				run_test(all[k]);
+			if (cfg.key_pull)
+				run_test("key-irq");
+		} else {
+			run_test(argv[i]);
+		}
+	}
+	if (cfg.fmt == FMT_JSON && results_printed)
+		printf("\n]\n");
+	return 0;
+}
@@ -1,17 +1,64 @@
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "../helloworld_char_driver/mydev.h"
+
+/*
+ * exercises the ioctl ABI of the helloworld char drivers (mydev.h), works with any of them:
+ * the char driver ("mknod /dev/mydev c 202 0" first), the class driver or the misc driver
+ */
 int main() {
-	/* first, you need to run "mknod /dev/mydev c 202 0" to create /dev/mydev */
-	int my_dev = open("/dev/mydev", 0);
+	struct mydev_stats stats;
+	struct mydev_op ops[4];
+	struct mydev_batch batch;
+	__u32 version;
+	int ret, i;
+
+	int my_dev = open("/dev/mydev", O_RDWR);
 	if (my_dev < 0) {
 		perror("Fail to open device file: /dev/mydev.");
+		return 1;
 	}
-	else {
-		ioctl(my_dev, 100, 110); /* cmd=100, arg=110 */
+
+	if (ioctl(my_dev, MYDEV_IOC_VERSION, &version) < 0) {
+		perror("MYDEV_IOC_VERSION");
 		close(my_dev);
+		return 1;
 	}
+	printf("abi version %u (built against %u)\n", version, MYDEV_ABI_VERSION);
+
+	/* one syscall for the whole burst: set, read back, stats. SET_VALUE only exists on the misc driver */
+	memset(ops, 0, sizeof(ops));
+	ops[0].code = MYDEV_OP_SET_VALUE;
+	ops[0].value = 110;
+	ops[1].code = MYDEV_OP_GET_VALUE;
+	ops[2].code = MYDEV_OP_GET_STATS;
+	ops[2].value = (uintptr_t)&stats;
+	ops[3].code = MYDEV_OP_NOP;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.count = 4;
+	batch.flags = MYDEV_BATCH_CONTINUE;
+	batch.ops = (uintptr_t)ops;
+
+	ret = ioctl(my_dev, MYDEV_IOC_BATCH, &batch);
+	if (ret < 0) {
+		perror("MYDEV_IOC_BATCH");
+		close(my_dev);
+		return 1;
+	}
+	printf("batch: %u of %u ops run\n", batch.completed, batch.count);
+	for (i = 0; i < (int)batch.completed; i++)
+		printf("  op %d: code %u result %d value %lld\n", i, ops[i].code, ops[i].result, (long long)ops[i].value);
+	if (ops[2].result == 0)
+		printf("stats: reads %llu (%llu bytes) writes %llu (%llu bytes)\n",
+		       (unsigned long long)stats.reads, (unsigned long long)stats.bytes_read,
+		       (unsigned long long)stats.writes, (unsigned long long)stats.bytes_written);
+
+	close(my_dev);
 	return 0;
 }
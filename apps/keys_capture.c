@@ -0,0 +1,290 @@
+/*
+ * keys_capture: reads the capture stream of hellokeys (/dev/hellokeys_capture) and decodes it
+ *
+ * the records (hellokeys.h) are turned back into absolute times and levels, printed as text
+ * ("<time ns> edge <key> <level>", "<time ns> bank <hex value>", "<time ns> sync lost <n>") or
+ * as a VCD file for GTKWave / sigrok (-f vcd). the capture itself is configured through sysfs,
+ * see KEYS_README "Capture mode".
+ *
+ *  -d <node>   capture node (default /dev/hellokeys_capture)
+ *  -m          consume the ring through mmap() instead of read()
+ *  -n <count>  stop after count records (default 0, run until interrupted)
+ *  -f text|vcd output format
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include "../platformDevice_module/hellokeys.h"
+
+#define NUM_KEYS 32
+
+struct decoder {
+	int vcd;
+	int synced;
+	uint64_t time;		/* of the last record */
+	uint64_t start;		/* VCD times are relative to the first SYNC */
+	uint64_t vcd_time;
+	uint32_t bank;
+	long records;
+};
+
+/* LEB128, returns the bytes used or 0 if the buffer ends first */
+static size_t get_varint(const uint8_t *p, size_t n, uint64_t *value)
+{
+	size_t i;
+
+	*value = 0;
+	for (i = 0; i < n && i < 10; i++) {
+		*value |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+		if (!(p[i] & 0x80))
+			return i + 1;
+	}
+	return 0;
+}
+
+static void vcd_header(void)
+{
+	int i;
+
+	printf("$timescale 1ns $end\n$scope module hellokeys $end\n");
+	for (i = 0; i < NUM_KEYS; i++)
+		printf("$var wire 1 k%d key%d $end\n", i, i);
+	printf("$var wire 32 bk bank $end\n$upscope $end\n$enddefinitions $end\n");
+}
+
+static void vcd_time(struct decoder *d)
+{
+	uint64_t t = d->time - d->start;
+
+	if (t != d->vcd_time || !d->records) {
+		printf("#%llu\n", (unsigned long long)t);
+		d->vcd_time = t;
+	}
+}
+
+static void print_bank(uint32_t v)
+{
+	int i;
+
+	putchar('b');
+	for (i = 31; i > 0 && !(v & (1u << i)); i--)
+		;
+	for (; i >= 0; i--)
+		putchar(v & (1u << i) ? '1' : '0');
+	printf(" bk\n");
+}
+
+/* decodes one record at p, returns its length or 0 when it isn't complete yet */
+static size_t decode(struct decoder *d, const uint8_t *p, size_t n)
+{
+	uint64_t dt, x, lost;
+	size_t len = 1, l;
+	int i;
+
+	if (!n)
+		return 0;
+
+	switch (p[0] & HELLOKEYS_REC_TYPE) {
+	case HELLOKEYS_REC_SYNC:
+		if (n < 9)
+			return 0;
+		l = get_varint(p + 9, n - 9, &lost);
+		if (!l)
+			return 0;
+		len = 9 + l;
+		d->time = 0;
+		for (i = 0; i < 8; i++)
+			d->time |= (uint64_t)p[1 + i] << (8 * i);
+		if (!d->synced)
+			d->start = d->time;
+		d->synced = 1;
+		d->bank = 0;
+		if (d->vcd) {
+			vcd_time(d);
+			print_bank(0);
+		} else {
+			printf("%llu sync lost %llu\n", (unsigned long long)d->time, (unsigned long long)lost);
+		}
+		break;
+	case HELLOKEYS_REC_EDGE:
+		l = get_varint(p + 1, n - 1, &dt);
+		if (!l)
+			return 0;
+		len += l;
+		d->time += dt;
+		if (d->vcd) {
+			vcd_time(d);
+			printf("%dk%d\n", !!(p[0] & HELLOKEYS_REC_LEVEL), p[0] & HELLOKEYS_REC_KEY);
+		} else {
+			printf("%llu edge %d %d\n", (unsigned long long)d->time, p[0] & HELLOKEYS_REC_KEY,
+			       !!(p[0] & HELLOKEYS_REC_LEVEL));
+		}
+		break;
+	case HELLOKEYS_REC_SAMPLE:
+		l = get_varint(p + 1, n - 1, &dt);
+		if (!l)
+			return 0;
+		len += l;
+		l = get_varint(p + len, n - len, &x);
+		if (!l)
+			return 0;
+		len += l;
+		d->time += dt;
+		d->bank ^= x;
+		if (d->vcd) {
+			vcd_time(d);
+			print_bank(d->bank);
+		} else {
+			printf("%llu bank %#x\n", (unsigned long long)d->time, d->bank);
+		}
+		break;
+	default:
+		fprintf(stderr, "bad record tag %#x\n", p[0]);
+		exit(1);
+	}
+	d->records++;
+	return len;
+}
+
+/* a record in the ring may wrap around its end, it is decoded from a linear copy then */
+static size_t decode_ring(struct decoder *d, const uint8_t *data, uint32_t size, uint32_t tail, uint32_t used)
+{
+	uint8_t rec[64];
+	uint32_t off = tail & (size - 1), n, i;
+
+	if (size - off >= sizeof(rec) || size - off >= used)
+		return decode(d, data + off, used < size - off ? used : size - off);
+	n = used < sizeof(rec) ? used : sizeof(rec);
+	for (i = 0; i < n; i++)
+		rec[i] = data[(tail + i) & (size - 1)];
+	return decode(d, rec, n);
+}
+
+static int run_mmap(int fd, struct decoder *d, long count)
+{
+	struct hellokeys_capture_ctrl *ctrl;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	const uint8_t *data;
+	uint32_t head, tail;
+	size_t len, map_len;
+
+	/* the control page tells how big the whole mapping is */
+	ctrl = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	if (ctrl == MAP_FAILED)
+		return -errno;
+	map_len = ctrl->data_offset + ctrl->size;
+	munmap(ctrl, sysconf(_SC_PAGESIZE));
+
+	ctrl = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ctrl == MAP_FAILED)
+		return -errno;
+	data = (const uint8_t *)ctrl + ctrl->data_offset;
+
+	tail = ctrl->tail;
+	while (!count || d->records < count) {
+		head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			fflush(stdout);
+			if (poll(&pfd, 1, -1) < 0)
+				return -errno;
+			continue;
+		}
+		/* the driver only publishes whole records */
+		len = decode_ring(d, data, ctrl->size, tail, head - tail);
+		if (!len) {
+			fprintf(stderr, "truncated record in the ring\n");
+			return -EIO;
+		}
+		tail += len;
+		__atomic_store_n(&ctrl->tail, tail, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+static int run_read(int fd, struct decoder *d, long count)
+{
+	uint8_t buf[65536];
+	size_t have = 0, off, len;
+	ssize_t ret;
+
+	while (!count || d->records < count) {
+		fflush(stdout);
+		ret = read(fd, buf + have, sizeof(buf) - have);
+		if (ret < 0)
+			return -errno;
+		have += ret;
+
+		/* a read() can end in the middle of a record, the rest comes with the next one */
+		off = 0;
+		while (off < have && (!count || d->records < count)) {
+			len = decode(d, buf + off, have - off);
+			if (!len)
+				break;
+			off += len;
+		}
+		memmove(buf, buf + off, have - off);
+		have -= off;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d node] [-m] [-n count] [-f text|vcd]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *node = "/dev/hellokeys_capture";
+	struct decoder d = { 0 };
+	long count = 0;
+	int use_mmap = 0;
+	int fd, opt, ret;
+
+	while ((opt = getopt(argc, argv, "d:mn:f:")) != -1) {
+		switch (opt) {
+		case 'd':
+			node = optarg;
+			break;
+		case 'm':
+			use_mmap = 1;
+			break;
+		case 'n':
+			count = atol(optarg);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "vcd"))
+				d.vcd = 1;
+			else if (strcmp(optarg, "text"))
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	fd = open(node, O_RDWR);
+	if (fd < 0) {
+		perror(node);
+		return 1;
+	}
+	if (d.vcd)
+		vcd_header();
+
+	ret = use_mmap ? run_mmap(fd, &d, count) : run_read(fd, &d, count);
+	fflush(stdout);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", node, strerror(-ret));
+		return 1;
+	}
+	return 0;
+}
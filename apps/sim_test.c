@@ -0,0 +1,323 @@
+/*
+ * sim_test: checks leds_driver and hellokeys on simulated GPIO lines (gpio-sim)
+ *
+ * needs the drivers bound to apps/sim-overlay.dts (see platformDevice_module/SIM_README), drives
+ * the lines through the gpio-sim sysfs files and asserts what the drivers did:
+ *  leds     a write to /dev/ledred and a frame on /dev/rgbleds show up on the LED lines
+ *  keys     pulling a key line gives a press and a release on /dev/hellokeys, in order and with
+ *           timestamps between the pull and the read
+ *  capture  the edges of a selected key appear in the /dev/hellokeys_capture stream after a SYNC,
+ *           with the right levels and timestamps, and the bank sampler is refused without a reg
+ *
+ * every check is printed, the exit status is 1 if any of them failed (2 when the lines are not
+ * there at all), so it can run from a script or CI in QEMU.
+ *
+ *  -l <dir>   gpio-sim chip directory of the LED bank  (default: first  gpiochip of gpio-sim)
+ *  -k <dir>   gpio-sim chip directory of the key bank  (default: second gpiochip of gpio-sim)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <glob.h>
+
+#include "../platformDevice_module/rgbleds.h"
+#include "../platformDevice_module/hellokeys.h"
+
+#define SIM_CHIPS	"/sys/devices/platform/gpio-sim/gpiochip*"
+#define CAPTURE_ATTR	"/sys/class/misc/hellokeys_capture/"
+#define TIMEOUT_MS	1000
+
+static const char *led_chip;
+static const char *key_chip;
+static int failures;
+
+static void check(int ok, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	printf("%s: ", ok ? "ok  " : "FAIL");
+	vprintf(fmt, ap);
+	printf("\n");
+	va_end(ap);
+	if (!ok)
+		failures++;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* returns 0 or -errno of the write */
+static int write_file(const char *path, const char *value)
+{
+	int fd, ret = 0;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, value, strlen(value)) < 0)
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+static int sim_value(const char *chip, int line)
+{
+	char path[512], buf[8] = "";
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/sim_gpio%d/value", chip, line);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (read(fd, buf, sizeof(buf) - 1) < 0)
+		buf[0] = 0;
+	close(fd);
+	return buf[0] == '1' ? 1 : buf[0] == '0' ? 0 : -1;
+}
+
+/* LEDs on sleeping lines are written from a worker, give it some time */
+static int wait_value(const char *chip, int line, int want)
+{
+	uint64_t end = now_ns() + TIMEOUT_MS * 1000000ull;
+	int value;
+
+	do {
+		value = sim_value(chip, line);
+		if (value == want)
+			break;
+		usleep(1000);
+	} while (now_ns() < end);
+	return value;
+}
+
+/* active low keys: pull-down is a press */
+static int pull_key(int line, int press)
+{
+	char path[512];
+
+	snprintf(path, sizeof(path), "%s/sim_gpio%d/pull", key_chip, line);
+	return write_file(path, press ? "pull-down" : "pull-up");
+}
+
+static void drain(int fd)
+{
+	char buf[4096];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+static int read_event(int fd, struct hellokeys_event *ev)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	if (poll(&pfd, 1, TIMEOUT_MS) != 1)
+		return -ETIMEDOUT;
+	return read(fd, ev, sizeof(*ev)) == sizeof(*ev) ? 0 : -EIO;
+}
+
+static void test_leds(void)
+{
+	uint32_t frame;
+	int fd, line;
+
+	fd = open("/dev/ledred", O_WRONLY);
+	check(fd >= 0, "open /dev/ledred");
+	if (fd >= 0) {
+		check(write(fd, "1", 1) == 1 && wait_value(led_chip, 0, 1) == 1, "ledred on -> line 0 high");
+		check(write(fd, "0", 1) == 1 && wait_value(led_chip, 0, 0) == 0, "ledred off -> line 0 low");
+		close(fd);
+	}
+
+	/* one bank on the sim overlay, bit n is line n */
+	fd = open("/dev/rgbleds", O_WRONLY);
+	check(fd >= 0, "open /dev/rgbleds");
+	if (fd < 0)
+		return;
+	for (frame = 0; frame < 8; frame++) {
+		if (write(fd, &frame, sizeof(frame)) != sizeof(frame)) {
+			check(0, "frame %#x write: %s", frame, strerror(errno));
+			continue;
+		}
+		for (line = 0; line < 3; line++)
+			check(wait_value(led_chip, line, !!(frame & (1u << line))) == !!(frame & (1u << line)),
+			      "frame %#x -> line %d %s", frame, line, frame & (1u << line) ? "high" : "low");
+	}
+	frame = 0;
+	if (write(fd, &frame, sizeof(frame)) < 0)
+		check(0, "frame 0 write: %s", strerror(errno));
+	close(fd);
+}
+
+static void test_keys(int fd)
+{
+	struct hellokeys_event press, release;
+	uint64_t t0, t1, t2;
+
+	t0 = now_ns();
+	check(!pull_key(0, 1), "pull key 0 down");
+	check(!read_event(fd, &press), "press event of key 0");
+	t1 = now_ns();
+	check(press.key == 0 && press.edge == HELLOKEYS_EDGE_PRESS, "press: key %u edge %u", press.key, press.edge);
+	check(press.timestamp_ns >= t0 && press.timestamp_ns <= t1, "press timestamp within the pull (%lld ns after it)",
+	      (long long)(press.timestamp_ns - t0));
+
+	check(!pull_key(0, 0), "pull key 0 up");
+	check(!read_event(fd, &release), "release event of key 0");
+	t2 = now_ns();
+	check(release.key == 0 && release.edge == HELLOKEYS_EDGE_RELEASE, "release: key %u edge %u",
+	      release.key, release.edge);
+	check(release.timestamp_ns >= t1 && release.timestamp_ns <= t2, "release timestamp within the pull");
+	check(release.timestamp_ns > press.timestamp_ns, "release after press");
+}
+
+/* LEB128, returns the bytes used or 0 */
+static size_t get_varint(const uint8_t *p, size_t n, uint64_t *value)
+{
+	size_t i;
+
+	*value = 0;
+	for (i = 0; i < n && i < 10; i++) {
+		*value |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+		if (!(p[i] & 0x80))
+			return i + 1;
+	}
+	return 0;
+}
+
+static void test_capture(int keys)
+{
+	struct hellokeys_event ev;
+	uint8_t buf[4096];
+	size_t have = 0, off = 1, l;
+	uint64_t t0, t1, time = 0, dt, lost;
+	int fd, i, edges = 0, level[2] = { -1, -1 };
+	ssize_t ret;
+
+	fd = open("/dev/hellokeys_capture", O_RDONLY | O_NONBLOCK);
+	check(fd >= 0, "open /dev/hellokeys_capture");
+	if (fd < 0)
+		return;
+	drain(fd);
+
+	/* sim lines have no RIO block behind them */
+	check(write_file(CAPTURE_ATTR "sample_rate", "1000") == -EOPNOTSUPP, "sampler refused without reg");
+
+	check(!write_file(CAPTURE_ATTR "capture_pins", "0x1"), "capture key 0");
+	t0 = now_ns();
+	for (i = 0; i < 2; i++) {
+		pull_key(0, !i);
+		read_event(keys, &ev);
+	}
+	t1 = now_ns();
+	check(!write_file(CAPTURE_ATTR "capture_pins", "0"), "capture off");
+
+	while ((ret = read(fd, buf + have, sizeof(buf) - have)) > 0)
+		have += ret;
+	check(have > 0, "capture stream has %zu bytes", have);
+	if (!have)
+		goto out;
+
+	/* the stream of a capture starts with a SYNC */
+	check(buf[0] == HELLOKEYS_REC_SYNC && have >= 10, "stream starts with SYNC");
+	if (buf[0] != HELLOKEYS_REC_SYNC || have < 10)
+		goto out;
+	for (i = 0; i < 8; i++)
+		time |= (uint64_t)buf[1 + i] << (8 * i);
+	off = 9;
+	l = get_varint(buf + off, have - off, &lost);
+	off += l;
+	check(l && !lost, "SYNC reports no loss");
+	check(time >= t0 && time <= t1, "SYNC time within the capture");
+
+	while (off < have && edges < 2) {
+		l = get_varint(buf + off + 1, have - off - 1, &dt);
+		if ((buf[off] & HELLOKEYS_REC_TYPE) != HELLOKEYS_REC_EDGE || !l) {
+			check(0, "record %#x at %zu is an EDGE", buf[off], off);
+			goto out;
+		}
+		time += dt;
+		check((buf[off] & HELLOKEYS_REC_KEY) == 0, "edge %d on key 0", edges);
+		check(time >= t0 && time <= t1, "edge %d time within the capture", edges);
+		level[edges++] = !!(buf[off] & HELLOKEYS_REC_LEVEL);
+		off += 1 + l;
+	}
+	/* raw levels: pulled down first, then up again */
+	check(level[0] == 0 && level[1] == 1, "edge levels %d then %d, want 0 then 1", level[0], level[1]);
+out:
+	close(fd);
+}
+
+static const char *find_chip(int n)
+{
+	static glob_t g;
+	static int done;
+
+	if (!done) {
+		done = 1;
+		if (glob(SIM_CHIPS, 0, NULL, &g))
+			return NULL;
+	}
+	return (size_t)n < g.gl_pathc ? g.gl_pathv[n] : NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, keys;
+
+	while ((opt = getopt(argc, argv, "l:k:")) != -1) {
+		switch (opt) {
+		case 'l':
+			led_chip = optarg;
+			break;
+		case 'k':
+			key_chip = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-l led chip dir] [-k key chip dir]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (!led_chip)
+		led_chip = find_chip(0);
+	if (!key_chip)
+		key_chip = find_chip(1);
+	if (!led_chip || !key_chip) {
+		fprintf(stderr, "sim_test: no gpio-sim chips, is apps/sim-overlay.dts loaded?\n");
+		return 2;
+	}
+	printf("LED lines %s, key lines %s\n", led_chip, key_chip);
+
+	test_leds();
+
+	/* lines start pulled down (all keys pressed), release them and forget those events */
+	keys = open("/dev/hellokeys", O_RDONLY | O_NONBLOCK);
+	check(keys >= 0, "open /dev/hellokeys");
+	if (keys >= 0) {
+		for (opt = 0; opt < 3; opt++)
+			pull_key(opt, 0);
+		usleep(100000);
+		drain(keys);
+
+		test_keys(keys);
+		test_capture(keys);
+		close(keys);
+	}
+
+	printf("%d check(s) failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,369 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Loopback ring shared by helloworld_rpi5_char_driver and helloworld_rpi5_class_driver
+ *
+ * one preallocated single producer / single consumer byte ring per device. whatever is written to
+ * the device can be read back from it in order.
+ *
+ * head and tail are free running 32 bit byte counters, the used part is head - tail and a position
+ * in the buffer is counter & (size - 1), so size has to be a power of two. the writer only stores
+ * head and the reader only stores tail, each publishes its counter with a release store after
+ * the data copy and reads the other one with an acquire load, so a reader and a writer never
+ * need a common lock. several readers (or writers) are serialized among themselves by
+ * read_lock (write_lock), which keeps it single producer / single consumer.
+ *
+ * the counters live in a control page in front of the data (struct mydev_ring_ctrl, mydev.h) and
+ * both can be mapped to userspace with hello_ring_mmap(), so a consumer can take the data in place
+ * and move tail itself instead of calling read(). head is kept in the ring as well and only
+ * copied out to the control page, tail is whatever the consumer stored there: the driver never
+ * trusts the mapped counters beyond clamping them to the ring size.
+ *
+ * reads and writes move as much as there is data / space for (like a pipe), they block while
+ * the ring is empty / full unless the file is O_NONBLOCK (-EAGAIN then). they work on iov_iters,
+ * so the drivers get readv()/writev() and, with copy_splice_read() / iter_file_splice_write(),
+ * splice()/sendfile() to and from pipes without a bounce through a user buffer.
+ * nothing is allocated on the data path, the buffer is allocated once at module init.
+ *
+ * hello_ring_resize() swaps in a new area while the device is in use: it holds both locks, so no
+ * read or write is in the middle of a copy, and moves the unread bytes over with the counters
+ * unchanged. the paths that look at the counters without a lock (poll, the wait conditions) read
+ * ctrl under rcu_read_lock(), the old area is freed after a grace period. a mapped ring can't be
+ * resized, the mapping would keep pointing at the old area.
+ */
+#ifndef _HELLO_RING_H
+#define _HELLO_RING_H
+
+#include <linux/fs.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/minmax.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/sched/signal.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/rcupdate.h>
+#include <linux/atomic.h>
+
+#include "mydev.h"
+#include "mydev_ioctl.h"
+
+#define HELLO_RING_MIN_SIZE	PAGE_SIZE
+#define HELLO_RING_MAX_SIZE	(64UL << 20)
+
+struct hello_ring {
+	struct mydev_ring_ctrl *ctrl;	/* first page of the vmalloc_user() area, data follows */
+	char *data;
+	size_t size;		/* power of two */
+	atomic_t mapped;	/* vmas mapping the area, -1 while a resize runs */
+	u32 head;		/* total bytes written, only stored by the writer, ctrl->head is a copy */
+	struct mutex read_lock;
+	struct mutex write_lock;
+	wait_queue_head_t readq;	/* readers waiting for data */
+	wait_queue_head_t writeq;	/* writers waiting for space */
+};
+
+/* size is rounded up to a power of two and clamped to [HELLO_RING_MIN_SIZE, HELLO_RING_MAX_SIZE] */
+static inline int hello_ring_init(struct hello_ring *ring, size_t size){
+	size = clamp_t(size_t, size, HELLO_RING_MIN_SIZE, HELLO_RING_MAX_SIZE);
+	ring->size = roundup_pow_of_two(size);
+
+	/* zeroed and ready to be mapped to userspace */
+	ring->ctrl = vmalloc_user(PAGE_SIZE + ring->size);
+	if (!ring->ctrl)
+		return -ENOMEM;
+	ring->data = (char *)ring->ctrl + PAGE_SIZE;
+	ring->ctrl->size = ring->size;
+	ring->ctrl->data_offset = PAGE_SIZE;
+
+	ring->head = 0;
+	atomic_set(&ring->mapped, 0);
+	mutex_init(&ring->read_lock);
+	mutex_init(&ring->write_lock);
+	init_waitqueue_head(&ring->readq);
+	init_waitqueue_head(&ring->writeq);
+	return 0;
+}
+
+static inline void hello_ring_free(struct hello_ring *ring){
+	vfree(ring->ctrl);
+	ring->ctrl = NULL;
+	ring->data = NULL;
+}
+
+/*
+ * bytes a reader can take, call from the reader side. a mapped consumer may have stored any tail.
+ * without read_lock (wait conditions) a resize may be going on, the value is only a hint then
+ */
+static inline size_t hello_ring_used(struct hello_ring *ring){
+	u32 used;
+
+	rcu_read_lock();
+	used = smp_load_acquire(&ring->head) - READ_ONCE(READ_ONCE(ring->ctrl)->tail);
+	rcu_read_unlock();
+	return min_t(size_t, used, READ_ONCE(ring->size));
+}
+
+/* bytes a writer can add, call from the writer side, a bogus tail from the mapping means no space */
+static inline size_t hello_ring_space(struct hello_ring *ring){
+	size_t size = READ_ONCE(ring->size);
+	u32 used;
+
+	rcu_read_lock();
+	used = READ_ONCE(ring->head) - smp_load_acquire(&READ_ONCE(ring->ctrl)->tail);
+	rcu_read_unlock();
+	return used > size ? 0 : size - used;
+}
+
+/* waits outside the lock, returns with the lock held and avail() non zero, or with an error */
+static inline int hello_ring_lock_when(struct hello_ring *ring, bool nonblock, struct mutex *lock,
+				       wait_queue_head_t *wq, size_t (*avail)(struct hello_ring *)){
+	int ret_val;
+
+	for (;;){
+		if (mutex_lock_interruptible(lock))
+			return -ERESTARTSYS;
+		if (avail(ring))
+			return 0;
+		mutex_unlock(lock);
+
+		if (nonblock)
+			return -EAGAIN;
+		ret_val = wait_event_interruptible(*wq, avail(ring));
+		if (ret_val)
+			return ret_val;
+	}
+}
+
+static inline bool hello_ring_nonblock(struct kiocb *iocb){
+	return (iocb->ki_flags & IOCB_NOWAIT) || (iocb->ki_filp->f_flags & O_NONBLOCK);
+}
+
+/*
+ * read_iter: fills the iov_iter (read(), readv(), splice to a pipe through copy_splice_read())
+ * from the ring, a fault in the middle returns what was copied up to it
+ */
+static inline ssize_t hello_ring_read_iter(struct hello_ring *ring, struct kiocb *iocb, struct iov_iter *to){
+	size_t off, len, first, copied;
+	u32 tail;
+	int ret_val;
+
+	if (!iov_iter_count(to))
+		return 0;
+
+	ret_val = hello_ring_lock_when(ring, hello_ring_nonblock(iocb), &ring->read_lock, &ring->readq, hello_ring_used);
+	if (ret_val)
+		return ret_val;
+
+	len = min(iov_iter_count(to), hello_ring_used(ring));
+	tail = READ_ONCE(ring->ctrl->tail);
+	off = tail & (ring->size - 1);
+	first = min(len, ring->size - off);
+	copied = copy_to_iter(ring->data + off, first, to);
+	if (copied == first && len > first)
+		copied += copy_to_iter(ring->data, len - first, to);
+	if (!copied){
+		mutex_unlock(&ring->read_lock);
+		return -EFAULT;
+	}
+
+	/* the data is copied out before the writer may reuse the space */
+	smp_store_release(&ring->ctrl->tail, tail + copied);
+	mutex_unlock(&ring->read_lock);
+
+	wake_up_interruptible(&ring->writeq);
+	return copied;
+}
+
+/* write_iter: write(), writev() and splice from a pipe through iter_file_splice_write() */
+static inline ssize_t hello_ring_write_iter(struct hello_ring *ring, struct kiocb *iocb, struct iov_iter *from){
+	size_t off, len, first, copied;
+	int ret_val;
+
+	if (!iov_iter_count(from))
+		return 0;
+
+	ret_val = hello_ring_lock_when(ring, hello_ring_nonblock(iocb), &ring->write_lock, &ring->writeq, hello_ring_space);
+	if (ret_val)
+		return ret_val;
+
+	len = min(iov_iter_count(from), hello_ring_space(ring));
+	off = ring->head & (ring->size - 1);
+	first = min(len, ring->size - off);
+	copied = copy_from_iter(ring->data + off, first, from);
+	if (copied == first && len > first)
+		copied += copy_from_iter(ring->data, len - first, from);
+	if (!copied){
+		mutex_unlock(&ring->write_lock);
+		return -EFAULT;
+	}
+
+	/* the data is in place before the reader can see it */
+	smp_store_release(&ring->head, ring->head + copied);
+	smp_store_release(&ring->ctrl->head, ring->head);
+	mutex_unlock(&ring->write_lock);
+
+	wake_up_interruptible(&ring->readq);
+	return copied;
+}
+
+/*
+ * a mapped consumer moves tail without entering the driver, so nothing would wake writers waiting
+ * for space. it polls for the next data anyway, that poll wakes them (like the AF_XDP kick).
+ */
+static inline __poll_t hello_ring_poll(struct hello_ring *ring, struct file *file, poll_table *wait){
+	__poll_t mask = 0;
+	u32 used;
+
+	poll_wait(file, &ring->readq, wait);
+	poll_wait(file, &ring->writeq, wait);
+
+	rcu_read_lock();
+	used = smp_load_acquire(&ring->head) - smp_load_acquire(&READ_ONCE(ring->ctrl)->tail);
+	rcu_read_unlock();
+	if (used)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (used < READ_ONCE(ring->size)){
+		mask |= EPOLLOUT | EPOLLWRNORM;
+		if (wq_has_sleeper(&ring->writeq))
+			wake_up_interruptible(&ring->writeq);
+	}
+	return mask;
+}
+
+/* counts the mappings, a vma split or fork opens another one */
+static inline void hello_ring_vm_open(struct vm_area_struct *vma){
+	struct hello_ring *ring = vma->vm_private_data;
+
+	atomic_inc(&ring->mapped);
+}
+
+static inline void hello_ring_vm_close(struct vm_area_struct *vma){
+	struct hello_ring *ring = vma->vm_private_data;
+
+	atomic_dec(&ring->mapped);
+}
+
+static const struct vm_operations_struct hello_ring_vm_ops = {
+	.open = hello_ring_vm_open,
+	.close = hello_ring_vm_close,
+};
+
+/*
+ * maps the control page at offset 0 and the data right behind it (ctrl->data_offset), the whole
+ * area or a part of it from the start. the counters are only shared with userspace, never trusted.
+ * counting the mapping first keeps a resize from swapping the area under it, no lock is taken here:
+ * mmap_lock is held and the read path faults with read_lock held
+ */
+static inline int hello_ring_mmap(struct hello_ring *ring, struct vm_area_struct *vma){
+	int ret_val;
+
+	if (vma->vm_pgoff)
+		return -EINVAL;
+	if (!atomic_inc_unless_negative(&ring->mapped))
+		return -EBUSY;
+
+	ret_val = -EINVAL;
+	if (vma->vm_end - vma->vm_start <= PAGE_SIZE + ring->size)
+		/* sets VM_DONTEXPAND | VM_DONTDUMP */
+		ret_val = remap_vmalloc_range(vma, ring->ctrl, 0);
+	if (ret_val){
+		atomic_dec(&ring->mapped);
+		return ret_val;
+	}
+	vma->vm_ops = &hello_ring_vm_ops;
+	vma->vm_private_data = ring;
+	return 0;
+}
+
+/*
+ * new size, rounded and clamped like in hello_ring_init(). the unread bytes stay in the ring,
+ * -ENOSPC when they don't fit into the new size, -EBUSY while the ring is mapped
+ */
+static inline int hello_ring_resize(struct hello_ring *ring, size_t size){
+	struct mydev_ring_ctrl *ctrl, *old;
+	size_t used, off, first;
+	char *data;
+	u32 tail;
+	int ret_val = 0;
+
+	size = roundup_pow_of_two(clamp_t(size_t, size, HELLO_RING_MIN_SIZE, HELLO_RING_MAX_SIZE));
+	if (size == READ_ONCE(ring->size))
+		return 0;
+
+	ctrl = vmalloc_user(PAGE_SIZE + size);
+	if (!ctrl)
+		return -ENOMEM;
+	data = (char *)ctrl + PAGE_SIZE;
+
+	/* no mapping now and none until the new area is in place */
+	if (atomic_cmpxchg(&ring->mapped, 0, -1)){
+		vfree(ctrl);
+		return -EBUSY;
+	}
+
+	/* the reader first, like everybody who takes both */
+	mutex_lock(&ring->read_lock);
+	mutex_lock(&ring->write_lock);
+	used = hello_ring_used(ring);
+	if (used > size){
+		ret_val = -ENOSPC;
+		goto unlock;
+	}
+
+	/* the unread bytes go to the same counter positions in the new buffer, in pieces which wrap in neither */
+	tail = ring->ctrl->tail;
+	for (off = 0; off < used; off += first){
+		first = min3(used - off, ring->size - ((tail + off) & (ring->size - 1)),
+			     size - ((tail + off) & (size - 1)));
+		memcpy(data + ((tail + off) & (size - 1)), ring->data + ((tail + off) & (ring->size - 1)), first);
+	}
+	ctrl->size = size;
+	ctrl->data_offset = PAGE_SIZE;
+	ctrl->head = ring->head;
+	ctrl->tail = tail;
+
+	old = ring->ctrl;
+	WRITE_ONCE(ring->ctrl, ctrl);
+	ring->data = data;
+	WRITE_ONCE(ring->size, size);
+	ctrl = old;
+unlock:
+	mutex_unlock(&ring->write_lock);
+	mutex_unlock(&ring->read_lock);
+	atomic_set(&ring->mapped, 0);
+
+	if (!ret_val){
+		/* waiters see the new space / data, lockless readers are done with the old area */
+		wake_up_interruptible(&ring->readq);
+		wake_up_interruptible(&ring->writeq);
+		synchronize_rcu();
+	}
+	vfree(ctrl);
+	return ret_val;
+}
+
+/* sub operations of the ioctl ABI (mydev_ioctl.h) for a ring device, nonblock see mydev_do_op_t */
+static inline int hello_ring_do_op(struct hello_ring *ring, struct mydev_op *op, bool nonblock){
+	switch (op->code){
+	case MYDEV_OP_GET_VALUE:
+		op->value = hello_ring_used(ring);
+		return 0;
+	case MYDEV_OP_FLUSH:
+		/* as if a reader took everything up to the current head */
+		if (!nonblock)
+			mutex_lock(&ring->read_lock);
+		else if (!mutex_trylock(&ring->read_lock))
+			return -EAGAIN;
+		smp_store_release(&ring->ctrl->tail, smp_load_acquire(&ring->head));
+		mutex_unlock(&ring->read_lock);
+		wake_up_interruptible(&ring->writeq);
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+#endif /* _HELLO_RING_H */
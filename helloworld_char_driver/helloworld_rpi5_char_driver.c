@@ -3,6 +3,9 @@
 /* header files to support character devices */
 #include <linux/cdev.h>
 #include <linux/fs.h>
+#include <linux/slab.h>
+
+#include "mydev_instance.h"
 
 #define MY_MAJOR_NUM 202 /* defined major number */
 
@@ -32,23 +35,120 @@ numbers can be seen by invoking ls -l /dev on the host PC
  * first is name of device node
  * second indicates whether the driver to which device node interfaces is block driver or character driver
  * last two param are major and minor numbers.
+ *
+ * The device is a loopback FIFO: bytes written to /dev/mydev are read back in order. it is backed by
+ * a preallocated single producer / single consumer ring (hello_ring.h), ring_size is its size in bytes
+ * (rounded up to a power of two). reads/writes block while the ring is empty/full, unless O_NONBLOCK.
+ * the data path is read_iter/write_iter, so readv()/writev() and splice()/sendfile() work as well.
+ * per CPU call/byte counters and latency histograms are in /sys/kernel/debug/<module name>/mydevN/stats.
+ *
+ * num_devices instances use minors 0..N-1 of major 202, each with its own ring and statistics
+ * (mydev_instance.h), they share no lock. the nodes are made by hand: mknod /dev/mydevN c 202 N
  */
 
-static struct cdev my_dev;
+static struct mydev_instance *my_devs;
+static unsigned int my_devs_created;
+static struct dentry *my_debugfs;
+
+/* my_devs_lock keeps a runtime ring_size change away from module init and exit */
+static DEFINE_MUTEX(my_devs_lock);
+
+static unsigned long ring_size = 1UL << 20;
+
+static int ring_size_set(const char *val, const struct kernel_param *kp){
+	unsigned long size;
+	int ret;
+
+	ret = mydev_parse_ring_size(val, &size);
+	if (ret)
+		return ret;
+
+	/* before init there is no instance yet, the value is just taken */
+	mutex_lock(&my_devs_lock);
+	ret = mydev_instances_resize(my_devs, my_devs_created, size);
+	if (!ret)
+		ring_size = size;
+	mutex_unlock(&my_devs_lock);
+	return ret;
+}
+
+static const struct kernel_param_ops ring_size_ops = {
+	.set = ring_size_set,
+	.get = param_get_ulong,
+};
+module_param_cb(ring_size, &ring_size_ops, &ring_size, 0644);
+MODULE_PARM_DESC(ring_size, "size of the loopback ring in bytes, rounded up to a power of two, can be changed at runtime");
+
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, S_IRUGO);
+MODULE_PARM_DESC(num_devices, "number of device instances, minors 0..num_devices-1 (1..64)");
 
 static int my_dev_open(struct inode *inode, struct file *file){
-	pr_info("my_dev_open() is called.\n");
-	return 0;
+	pr_debug("my_dev_open() is called for minor %u.\n", iminor(inode));
+	return mydev_instance_open(inode, file);
 }
 
 static int my_dev_close(struct inode *inode, struct file *file){
-	pr_info("my_dev_close() is called.\n");
+	pr_debug("my_dev_close() is called.\n");
 	return 0;
 }
 
+static ssize_t my_dev_read_iter(struct kiocb *iocb, struct iov_iter *to){
+	struct mydev_instance *inst = mydev_instance_of(iocb->ki_filp);
+	ktime_t start = mydev_stats_start();
+	ssize_t ret;
+
+	ret = hello_ring_read_iter(&inst->ring, iocb, to);
+	mydev_stats_account(&inst->stats, MYDEV_STAT_READ, start, ret);
+	return ret;
+}
+
+static ssize_t my_dev_write_iter(struct kiocb *iocb, struct iov_iter *from){
+	struct mydev_instance *inst = mydev_instance_of(iocb->ki_filp);
+	ktime_t start = mydev_stats_start();
+	ssize_t ret;
+
+	ret = hello_ring_write_iter(&inst->ring, iocb, from);
+	mydev_stats_account(&inst->stats, MYDEV_STAT_WRITE, start, ret);
+	return ret;
+}
+
+static __poll_t my_dev_poll(struct file *file, poll_table *wait){
+	return hello_ring_poll(&mydev_instance_of(file)->ring, file, wait);
+}
+
+static int my_dev_do_op(struct file *file, struct mydev_op *op, bool nonblock){
+	struct mydev_instance *inst = mydev_instance_of(file);
+	int ret = mydev_stats_do_op(&inst->stats, op);
+
+	if (ret != -ENOIOCTLCMD)
+		return ret;
+	return hello_ring_do_op(&inst->ring, op, nonblock);
+}
+
+/* the ABI is in mydev.h, single ops and batches of them */
 static long my_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
-	pr_info("my_dev_ioctl() is called. cmd=%d, arg=%ld\n", cmd, arg);
-	return 0;
+	ktime_t start = mydev_stats_start();
+	long ret;
+
+	pr_debug("my_dev_ioctl() is called. cmd=%d, arg=%ld\n", cmd, arg);
+	ret = mydev_ioctl(file, cmd, arg, my_dev_do_op);
+	mydev_stats_account(&mydev_instance_of(file)->stats, MYDEV_STAT_IOCTL, start, ret);
+	return ret;
+}
+
+/* io_uring passthrough of the same commands, one cqe per command */
+static int my_dev_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags){
+	struct mydev_instance *inst = mydev_instance_of(ioucmd->file);
+	ktime_t start = mydev_stats_start();
+	int ret;
+
+	ret = mydev_uring_cmd(ioucmd, issue_flags, my_dev_do_op);
+	/* the punt of a nonblocking issue is not a call, io-wq issues the command again */
+	if (ret == -EAGAIN && (issue_flags & IO_URING_F_NONBLOCK))
+		return ret;
+	mydev_stats_account(&inst->stats, MYDEV_STAT_IOCTL, start, ret);
+	return ret;
 }
 
 /* Declare a file_operations structure */
@@ -56,38 +156,91 @@ static const struct file_operations my_dev_fops = {
 	.owner = THIS_MODULE,
 	.open = my_dev_open,
 	.release = my_dev_close,
+	.read_iter = my_dev_read_iter,
+	.write_iter = my_dev_write_iter,
+	.splice_read = copy_splice_read,
+	.splice_write = iter_file_splice_write,
+	.poll = my_dev_poll,
 	.unlocked_ioctl = my_dev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.uring_cmd = my_dev_uring_cmd,
 };
 
+/* tears down the instances added so far and the device numbers, my_devs_lock held */
+static void my_dev_destroy(void){
+	struct mydev_instance *inst;
+
+	while (my_devs_created){
+		inst = &my_devs[--my_devs_created];
+		cdev_del(&inst->cdev);
+		mydev_instance_free(inst);
+	}
+	unregister_chrdev_region(MKDEV(MY_MAJOR_NUM, 0), num_devices);
+	debugfs_remove_recursive(my_debugfs);
+	kfree(my_devs);
+}
+
 static int __init hello_init(void){
+	struct mydev_instance *inst;
+	char name[16];
 	int ret;
 
 	dev_t dev = MKDEV(MY_MAJOR_NUM, 0); /*get first device identifier */
 	pr_info("Hello world init\n");
 
+	if (!num_devices || num_devices > MYDEV_MAX_DEVICES){
+		pr_info("num_devices must be 1..%d\n", MYDEV_MAX_DEVICES);
+		return -EINVAL;
+	}
+	my_devs = kcalloc(num_devices, sizeof(*my_devs), GFP_KERNEL);
+	if (!my_devs)
+		return -ENOMEM;
+
 	/* allocate all the character device identifiers,
-	 * only one in this case, obtained with MKDEV macro*/
-	ret = register_chrdev_region(dev, 1, "my_char_device");
+	 * one minor per instance, starting at the one obtained with MKDEV macro*/
+	ret = register_chrdev_region(dev, num_devices, "my_char_device");
 	if (ret < 0){
 		pr_info("Unable to allocate major number %d\n", MY_MAJOR_NUM);
+		kfree(my_devs);
 		return ret;
 	}
 
-	/* Initialize the cdev structure and add it to kernel space */
-	cdev_init(&my_dev, &my_dev_fops);
-	ret = cdev_add(&my_dev, dev, 1);
-	if (ret < 0){
-		unregister_chrdev_region(dev, 1);
-		pr_info("Unable to add cdev\n");
-		return ret;
+	/* the parent of the stats directory of every instance */
+	my_debugfs = debugfs_create_dir(KBUILD_MODNAME, NULL);
+
+	mutex_lock(&my_devs_lock);
+	for (my_devs_created = 0; my_devs_created < num_devices; my_devs_created++){
+		inst = &my_devs[my_devs_created];
+		snprintf(name, sizeof(name), "mydev%u", my_devs_created);
+		ret = mydev_instance_init(inst, my_devs_created, ring_size, name, my_debugfs);
+		if (ret < 0){
+			pr_info("Unable to allocate the ring of minor %u\n", my_devs_created);
+			my_dev_destroy();
+			mutex_unlock(&my_devs_lock);
+			return ret;
+		}
+
+		/* Initialize the cdev structure and add it to kernel space */
+		cdev_init(&inst->cdev, &my_dev_fops);
+		ret = cdev_add(&inst->cdev, dev + my_devs_created, 1);
+		if (ret < 0){
+			mydev_instance_free(inst);
+			pr_info("Unable to add cdev of minor %u\n", my_devs_created);
+			my_dev_destroy();
+			mutex_unlock(&my_devs_lock);
+			return ret;
+		}
 	}
+	mutex_unlock(&my_devs_lock);
+	pr_info("%u devices with rings of %zu bytes\n", num_devices, my_devs[0].ring.size);
 	return 0;
 }
 
 static void __exit hello_exit(void){
 	pr_info("Hello world exit\n");
-	cdev_del(&my_dev);
-	unregister_chrdev_region(MKDEV(MY_MAJOR_NUM, 0), 1);
+	mutex_lock(&my_devs_lock);
+	my_dev_destroy();
+	mutex_unlock(&my_devs_lock);
 }
 
 module_init(hello_init);
@@ -96,5 +249,3 @@ module_exit(hello_exit);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Balavignesh");
 MODULE_DESCRIPTION("Module that interacts with the ioctl system call");
-
-
@@ -14,54 +14,231 @@
  *
  *
  * alloc_chrdev_region() - automatically allocates a major number to device, registering the device class anc creating the device node.
+ *
+ * The device is a loopback FIFO: bytes written to /dev/mydev are read back in order. it is backed by
+ * a preallocated single producer / single consumer ring (hello_ring.h), ring_size is its size in bytes
+ * (rounded up to a power of two). reads/writes block while the ring is empty/full, unless O_NONBLOCK.
+ * the data path is read_iter/write_iter, so readv()/writev() and splice()/sendfile() work as well.
+ * per CPU call/byte counters and latency histograms are in /sys/kernel/debug/<module name>/<device>/stats.
+ *
+ * mmap() maps the ring to the consumer: a control page with the head/tail counters followed by the data
+ * (struct mydev_ring_ctrl in mydev.h), so samples can be taken in place without read() copying them.
+ *
+ * num_devices instances get one minor each, /dev/mydev0 .. /dev/mydev<N-1> (just /dev/mydev with
+ * one), each with its own ring and statistics (mydev_instance.h), they share no lock.
  */
 
 #include <linux/module.h>
 #include <linux/cdev.h>
 #include <linux/fs.h>
 #include <linux/device.h> /* class_create(), device_create().. */
+#include <linux/slab.h>
+
+#include "mydev_instance.h"
 
 #define DEVICE_NAME "mydev"
 #define CLASS_NAME "hello_class"
 
 static struct class *helloClass;
-static struct cdev my_dev;
+static struct mydev_instance *my_devs;
+static unsigned int my_devs_created;
+static struct dentry *my_debugfs;
 dev_t dev;
 
+/* my_devs_lock keeps a runtime ring_size change away from module init and exit */
+static DEFINE_MUTEX(my_devs_lock);
+
+static unsigned long ring_size = 1UL << 20;
+
+static int ring_size_set(const char *val, const struct kernel_param *kp){
+	unsigned long size;
+	int ret;
+
+	ret = mydev_parse_ring_size(val, &size);
+	if (ret)
+		return ret;
+
+	/* before init there is no instance yet, the value is just taken */
+	mutex_lock(&my_devs_lock);
+	ret = mydev_instances_resize(my_devs, my_devs_created, size);
+	if (!ret)
+		ring_size = size;
+	mutex_unlock(&my_devs_lock);
+	return ret;
+}
+
+static const struct kernel_param_ops ring_size_ops = {
+	.set = ring_size_set,
+	.get = param_get_ulong,
+};
+module_param_cb(ring_size, &ring_size_ops, &ring_size, 0644);
+MODULE_PARM_DESC(ring_size, "size of the loopback ring in bytes, rounded up to a power of two, can be changed at runtime");
+
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, S_IRUGO);
+MODULE_PARM_DESC(num_devices, "number of device instances, each with its own minor and ring (1..64)");
+
 static int my_dev_open(struct inode *inode, struct file *file){
-	pr_info("my_dev_open() is called\n");
-	return 0;
+	pr_debug("my_dev_open() is called for minor %u\n", iminor(inode));
+	return mydev_instance_open(inode, file);
 }
 
 static int my_dev_close(struct inode *inode, struct file *file){
-	pr_info("my_dev_close() is called\n");
+	pr_debug("my_dev_close() is called\n");
 	return 0;
 }
 
+static ssize_t my_dev_read_iter(struct kiocb *iocb, struct iov_iter *to){
+	struct mydev_instance *inst = mydev_instance_of(iocb->ki_filp);
+	ktime_t start = mydev_stats_start();
+	ssize_t ret;
+
+	ret = hello_ring_read_iter(&inst->ring, iocb, to);
+	mydev_stats_account(&inst->stats, MYDEV_STAT_READ, start, ret);
+	return ret;
+}
+
+static ssize_t my_dev_write_iter(struct kiocb *iocb, struct iov_iter *from){
+	struct mydev_instance *inst = mydev_instance_of(iocb->ki_filp);
+	ktime_t start = mydev_stats_start();
+	ssize_t ret;
+
+	ret = hello_ring_write_iter(&inst->ring, iocb, from);
+	mydev_stats_account(&inst->stats, MYDEV_STAT_WRITE, start, ret);
+	return ret;
+}
+
+static __poll_t my_dev_poll(struct file *file, poll_table *wait){
+	return hello_ring_poll(&mydev_instance_of(file)->ring, file, wait);
+}
+
+static int my_dev_mmap(struct file *file, struct vm_area_struct *vma){
+	return hello_ring_mmap(&mydev_instance_of(file)->ring, vma);
+}
+
+static int my_dev_do_op(struct file *file, struct mydev_op *op, bool nonblock){
+	struct mydev_instance *inst = mydev_instance_of(file);
+	int ret = mydev_stats_do_op(&inst->stats, op);
+
+	if (ret != -ENOIOCTLCMD)
+		return ret;
+	return hello_ring_do_op(&inst->ring, op, nonblock);
+}
+
+/* the ABI is in mydev.h, single ops and batches of them */
 static long my_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
-	pr_info("my_dev_ioctl() is called. cmd=%d, arg=%ld\n", cmd, arg);
-	return 0;
+	ktime_t start = mydev_stats_start();
+	long ret;
+
+	pr_debug("my_dev_ioctl() is called. cmd=%d, arg=%ld\n", cmd, arg);
+	ret = mydev_ioctl(file, cmd, arg, my_dev_do_op);
+	mydev_stats_account(&mydev_instance_of(file)->stats, MYDEV_STAT_IOCTL, start, ret);
+	return ret;
+}
+
+/* io_uring passthrough of the same commands, one cqe per command */
+static int my_dev_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags){
+	struct mydev_instance *inst = mydev_instance_of(ioucmd->file);
+	ktime_t start = mydev_stats_start();
+	int ret;
+
+	ret = mydev_uring_cmd(ioucmd, issue_flags, my_dev_do_op);
+	/* the punt of a nonblocking issue is not a call, io-wq issues the command again */
+	if (ret == -EAGAIN && (issue_flags & IO_URING_F_NONBLOCK))
+		return ret;
+	mydev_stats_account(&inst->stats, MYDEV_STAT_IOCTL, start, ret);
+	return ret;
 }
 
 static const struct file_operations my_dev_fops = {
 	.owner = THIS_MODULE,
 	.open = my_dev_open,
 	.release = my_dev_close,
+	.read_iter = my_dev_read_iter,
+	.write_iter = my_dev_write_iter,
+	.splice_read = copy_splice_read,
+	.splice_write = iter_file_splice_write,
+	.poll = my_dev_poll,
+	.mmap = my_dev_mmap,
 	.unlocked_ioctl = my_dev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.uring_cmd = my_dev_uring_cmd,
 };
 
+/* ring, cdev and device node of instance i */
+static int my_dev_create(unsigned int i){
+	struct mydev_instance *inst = &my_devs[i];
+	struct device *helloDevice;
+	char name[16];
+	int ret;
+
+	if (num_devices == 1)
+		strscpy(name, DEVICE_NAME, sizeof(name));
+	else
+		snprintf(name, sizeof(name), DEVICE_NAME "%u", i);
+
+	ret = mydev_instance_init(inst, i, ring_size, name, my_debugfs);
+	if (ret < 0){
+		pr_info("unable to allocate the ring of %s\n", name);
+		return ret;
+	}
+
+	/* initialize the cdev structure and add it to kernel space */
+	cdev_init(&inst->cdev, &my_dev_fops);
+	ret = cdev_add(&inst->cdev, dev + i, 1);
+	if (ret < 0){
+		mydev_instance_free(inst);
+		pr_info("unable to add cdev of %s\n", name);
+		return ret;
+	}
+
+	/* create a device node */
+	helloDevice = device_create(helloClass, NULL, dev + i, NULL, "%s", name);
+	if (IS_ERR(helloDevice)){
+		cdev_del(&inst->cdev);
+		mydev_instance_free(inst);
+		pr_info("failed to create the device %s\n", name);
+		return PTR_ERR(helloDevice);
+	}
+	return 0;
+}
+
+/* tears down the instances created so far, the class and the device numbers, my_devs_lock held */
+static void my_dev_destroy(void){
+	struct mydev_instance *inst;
+
+	while (my_devs_created){
+		inst = &my_devs[--my_devs_created];
+		device_destroy(helloClass, dev + inst->index);
+		cdev_del(&inst->cdev);
+		mydev_instance_free(inst);
+	}
+	class_destroy(helloClass);
+	unregister_chrdev_region(dev, num_devices);
+	debugfs_remove_recursive(my_debugfs);
+	kfree(my_devs);
+}
+
 static int __init hello_init(void){
 	int ret;
 	dev_t dev_no;
 	int Major;
-	struct device *helloDevice;
 
 	pr_info("Hello world init\n");
 
-	/* Allocate dynamically device numbers (only one in this driver) */
-	ret = alloc_chrdev_region(&dev_no, 0, 1, DEVICE_NAME);
+	if (!num_devices || num_devices > MYDEV_MAX_DEVICES){
+		pr_info("num_devices must be 1..%d\n", MYDEV_MAX_DEVICES);
+		return -EINVAL;
+	}
+	my_devs = kcalloc(num_devices, sizeof(*my_devs), GFP_KERNEL);
+	if (!my_devs)
+		return -ENOMEM;
+
+	/* Allocate dynamically device numbers, one minor per instance */
+	ret = alloc_chrdev_region(&dev_no, 0, num_devices, DEVICE_NAME);
 	if (ret < 0){
 		pr_info("unable to alloacte Major number \n");
+		kfree(my_devs);
 		return ret;
 	}
 
@@ -73,42 +250,37 @@ static int __init hello_init(void){
 
 	pr_info("allocated correctly with major number %d\n", Major);
 
-	/* initialize the cdev structure and add it to kernel space */
-	cdev_init(&my_dev, &my_dev_fops);
-	ret = cdev_add(&my_dev, dev, 1);
-	if (ret < 0){
-		unregister_chrdev_region(dev, 1);
-		pr_info("unable to add cdev\n");
-		return ret;
-	}
-
 	/* register the device class */
 	helloClass = class_create(CLASS_NAME);
 	if (IS_ERR(helloClass)){
-		unregister_chrdev_region(dev, 1);
-		cdev_del(&my_dev);
+		unregister_chrdev_region(dev, num_devices);
+		kfree(my_devs);
 		pr_info("failed to register device class\n");
 		return PTR_ERR(helloClass);
 	}
 	pr_info("device class registered correctly\n");
 
-	/* create a device node */
-	helloDevice = device_create(helloClass, NULL, dev, NULL, DEVICE_NAME);
-	if (IS_ERR(helloDevice)){
-		unregister_chrdev_region(dev, 1);
-		cdev_del(&my_dev);
-		pr_info("failed to create the device\n");
-		return PTR_ERR(helloDevice);
+	/* the parent of the stats directory of every instance */
+	my_debugfs = debugfs_create_dir(KBUILD_MODNAME, NULL);
+
+	mutex_lock(&my_devs_lock);
+	for (my_devs_created = 0; my_devs_created < num_devices; my_devs_created++){
+		ret = my_dev_create(my_devs_created);
+		if (ret < 0){
+			my_dev_destroy();
+			mutex_unlock(&my_devs_lock);
+			return ret;
+		}
 	}
-	pr_info("device is created correctly\n");
+	mutex_unlock(&my_devs_lock);
+	pr_info("%u devices with rings of %zu bytes are created correctly\n", num_devices, my_devs[0].ring.size);
 	return 0;
 }
 
 static void __exit hello_exit(void){
-	device_destroy(helloClass, dev);
-	class_destroy(helloClass);
-	cdev_del(&my_dev);
-	unregister_chrdev_region(dev, 1);
+	mutex_lock(&my_devs_lock);
+	my_dev_destroy();
+	mutex_unlock(&my_devs_lock);
 	pr_info("hello world with parameter exit\n");
 }
 
@@ -25,32 +25,200 @@
  * parent - pointer to device structure that represents the hardware device exposed by the driver
  *
  * misc driver exports two functions, misc_register(), misc_deregister() to register and unregister their own minor number.
+ *
+ * mydev holds a single integer value. writing a number stores it, reading returns it as "%d\n".
+ * every open file remembers the version of the value it read last: a read blocks until the value
+ * was written again (or returns -EAGAIN with O_NONBLOCK) and poll() reports EPOLLIN once it was,
+ * so a process can wait for changes made by others instead of re-reading in a loop. the first
+ * read of a file always returns the current value.
+ *
+ * ioctls follow the ABI of the helloworld char drivers (mydev.h): the value and the statistics
+ * can also be read and set through single ops or batches of them. the value is guarded by a
+ * spinlock, nothing in the ops waits, so their io_uring commands always complete inline. per CPU call/byte counters and
+ * latency histograms are in /sys/kernel/debug/misc_rpi5_driver/stats.
  */
 
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+
+#include "mydev_ioctl.h"
+#include "mydev_stats.h"
+
+static struct miscdevice helloworld_miscdevice;
+
+static DEFINE_SPINLOCK(my_dev_lock);
+static DECLARE_WAIT_QUEUE_HEAD(my_dev_wait);
+static int my_dev_value;
+static unsigned int my_dev_gen; /* bumped on every write, protected by my_dev_lock */
+static struct mydev_dev_stats my_stats;
+
+/* per open file, the generation of the value this file returned last */
+struct my_dev_file {
+	unsigned int seen;
+};
 
 static int my_dev_open(struct inode *inode, struct file *file){
-	pr_info("my_dev_open() is called\n");
+	struct my_dev_file *ctx;
+
+	dev_dbg(helloworld_miscdevice.this_device, "my_dev_open() is called\n");
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	spin_lock(&my_dev_lock);
+	ctx->seen = my_dev_gen - 1;
+	spin_unlock(&my_dev_lock);
+
+	file->private_data = ctx;
 	return 0;
 }
 
 static int my_dev_close(struct inode *inode, struct file *file){
-	pr_info("my_dev_close() is called\n");
+	dev_dbg(helloworld_miscdevice.this_device, "my_dev_close() is called\n");
+	kfree(file->private_data);
 	return 0;
 }
 
+static bool my_dev_changed(struct my_dev_file *ctx){
+	return READ_ONCE(my_dev_gen) != ctx->seen;
+}
+
+static ssize_t my_dev_read_value(struct file *file, char __user *buff, size_t count){
+	struct my_dev_file *ctx = file->private_data;
+	char kbuf[16];
+	int len;
+	int ret_val;
+
+	spin_lock(&my_dev_lock);
+	while (my_dev_gen == ctx->seen){
+		spin_unlock(&my_dev_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret_val = wait_event_interruptible(my_dev_wait, my_dev_changed(ctx));
+		if (ret_val)
+			return ret_val;
+		spin_lock(&my_dev_lock);
+	}
+	len = scnprintf(kbuf, sizeof(kbuf), "%d\n", my_dev_value);
+	/* a buffer too short for the value does not consume it */
+	if (count < len){
+		spin_unlock(&my_dev_lock);
+		return -EINVAL;
+	}
+	ctx->seen = my_dev_gen;
+	spin_unlock(&my_dev_lock);
+
+	if (copy_to_user(buff, kbuf, len))
+		return -EFAULT;
+	return len;
+}
+
+static ssize_t my_dev_read(struct file *file, char __user *buff, size_t count, loff_t *ppos){
+	ktime_t start = mydev_stats_start();
+	ssize_t ret;
+
+	ret = my_dev_read_value(file, buff, count);
+	mydev_stats_account(&my_stats, MYDEV_STAT_READ, start, ret);
+	return ret;
+}
+
+/* stores a new value and wakes everybody waiting for a change */
+static void my_dev_store(int value){
+	spin_lock(&my_dev_lock);
+	my_dev_value = value;
+	WRITE_ONCE(my_dev_gen, my_dev_gen + 1);
+	spin_unlock(&my_dev_lock);
+
+	wake_up_interruptible_all(&my_dev_wait);
+}
+
+static ssize_t my_dev_write(struct file *file, const char __user *buff, size_t count, loff_t *ppos){
+	ktime_t start = mydev_stats_start();
+	ssize_t ret;
+	int value;
+
+	ret = kstrtoint_from_user(buff, count, 0, &value);
+	if (!ret){
+		my_dev_store(value);
+		ret = count;
+	}
+	mydev_stats_account(&my_stats, MYDEV_STAT_WRITE, start, ret);
+	return ret;
+}
+
+static __poll_t my_dev_poll(struct file *file, poll_table *wait){
+	struct my_dev_file *ctx = file->private_data;
+	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(file, &my_dev_wait, wait);
+	if (my_dev_changed(ctx))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	return mask;
+}
+
+static int my_dev_do_op(struct file *file, struct mydev_op *op, bool nonblock){
+	int ret = mydev_stats_do_op(&my_stats, op);
+
+	if (ret != -ENOIOCTLCMD)
+		return ret;
+
+	switch (op->code){
+	case MYDEV_OP_GET_VALUE:
+		spin_lock(&my_dev_lock);
+		op->value = (__s64)my_dev_value;
+		spin_unlock(&my_dev_lock);
+		return 0;
+	case MYDEV_OP_SET_VALUE:
+		if ((__s64)op->value < INT_MIN || (__s64)op->value > INT_MAX)
+			return -ERANGE;
+		my_dev_store((int)op->value);
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+/* the ABI is in mydev.h, single ops and batches of them */
 static long my_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
-	pr_info("my_dev_ioctl() is called, cmd=%d, arg=%ld\n", cmd, arg);
-	return 0;
+	ktime_t start = mydev_stats_start();
+	long ret;
+
+	pr_debug("my_dev_ioctl() is called, cmd=%d, arg=%ld\n", cmd, arg);
+	ret = mydev_ioctl(file, cmd, arg, my_dev_do_op);
+	mydev_stats_account(&my_stats, MYDEV_STAT_IOCTL, start, ret);
+	return ret;
+}
+
+/* io_uring passthrough of the same commands, one cqe per command */
+static int my_dev_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags){
+	ktime_t start = mydev_stats_start();
+	int ret;
+
+	ret = mydev_uring_cmd(ioucmd, issue_flags, my_dev_do_op);
+	/* nothing here punts today, a punt would be counted again from io-wq */
+	if (ret == -EAGAIN && (issue_flags & IO_URING_F_NONBLOCK))
+		return ret;
+	mydev_stats_account(&my_stats, MYDEV_STAT_IOCTL, start, ret);
+	return ret;
 }
 
 static const struct file_operations my_dev_fops = {
 	.owner = THIS_MODULE,
 	.open = my_dev_open,
 	.release = my_dev_close,
+	.read = my_dev_read,
+	.write = my_dev_write,
+	.poll = my_dev_poll,
 	.unlocked_ioctl = my_dev_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.uring_cmd = my_dev_uring_cmd,
 };
 
 static struct miscdevice helloworld_miscdevice = {
@@ -63,11 +231,16 @@ static int __init hello_init(void){
 	int ret_val;
 	pr_info("Hello world init\n");
 
+	ret_val = mydev_stats_init(&my_stats, KBUILD_MODNAME, NULL);
+	if (ret_val != 0)
+		return ret_val;
+
 	/* register the device with kernel */
 	ret_val = misc_register(&helloworld_miscdevice);
 
 	if (ret_val != 0){
 		pr_err("could not register the misc device mydev");
+		mydev_stats_free(&my_stats);
 		return ret_val;
 	}
 	pr_info("mydev: got minor %i\n", helloworld_miscdevice.minor);
@@ -78,6 +251,7 @@ static void __exit hello_exit(void){
 	pr_info("hello world exit\n");
 
 	misc_deregister(&helloworld_miscdevice);
+	mydev_stats_free(&my_stats);
 }
 
 module_init(hello_init);
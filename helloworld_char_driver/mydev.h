@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace ABI of the helloworld char drivers (/dev/mydev), shared with the apps in apps/
+ */
+#ifndef _MYDEV_H
+#define _MYDEV_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Mapped ring of helloworld_rpi5_class_driver
+ *
+ * mmap() of /dev/mydev at offset 0 gives the control page followed by the data area at
+ * data_offset, size bytes. head and tail are free running byte counters, the bytes in
+ * [tail, head) are unread and byte n lives at data[n & (size - 1)].
+ *
+ * a consumer loads head with acquire semantics, uses the data in place and then stores the new
+ * tail with release semantics (__atomic_load_n / __atomic_store_n in C). when it runs out of data
+ * it poll()s for POLLIN, the poll also wakes writers waiting for the space it freed.
+ * only one consumer at a time: either read() or the mapping, not both.
+ */
+struct mydev_ring_ctrl {
+	__u32 head;		/* moved by the driver only */
+	__u32 size;		/* data area size in bytes, power of two */
+	__u32 data_offset;	/* offset of the data area in the mapping */
+	__u32 pad0[13];		/* tail on its own 64 byte cache line */
+	__u32 tail;		/* moved by the consumer */
+	__u32 pad1[15];
+};
+
+/*
+ * ioctl ABI, the same for all three drivers (char, class and misc)
+ *
+ * MYDEV_IOC_VERSION returns MYDEV_ABI_VERSION, it only changes when the existing structs or
+ * commands change meaning, new commands and ops keep the version.
+ *
+ * the work is done by sub operations (struct mydev_op). MYDEV_IOC_OP runs one, MYDEV_IOC_BATCH
+ * runs an array of them in one call, in order. every op gets its own result (0 or -errno),
+ * a batch stops at the first failing op unless MYDEV_BATCH_CONTINUE is set. the ioctl returns
+ * the number of ops run (also in batch.completed) or -errno when the batch itself is bad.
+ */
+#define MYDEV_ABI_VERSION	1
+
+enum mydev_op_code {
+	MYDEV_OP_NOP = 0,
+	MYDEV_OP_GET_VALUE,	/* value = the stored value (misc), unread bytes (char/class) */
+	MYDEV_OP_SET_VALUE,	/* stores value (misc only) */
+	MYDEV_OP_GET_STATS,	/* value = user pointer to a struct mydev_stats to fill */
+	MYDEV_OP_RESET_STATS,
+	MYDEV_OP_FLUSH,		/* drops the unread bytes of the ring (char/class only) */
+};
+
+struct mydev_op {
+	__u16 code;		/* enum mydev_op_code */
+	__u16 flags;		/* 0 */
+	__s32 result;		/* out: 0 or -errno */
+	__u64 value;		/* in/out, see the op */
+};
+
+struct mydev_stats {
+	__u64 reads;
+	__u64 writes;
+	__u64 bytes_read;
+	__u64 bytes_written;
+};
+
+#define MYDEV_BATCH_MAX		256
+#define MYDEV_BATCH_CONTINUE	0x1	/* run the remaining ops after a failing one */
+
+struct mydev_batch {
+	__u32 count;		/* number of ops, at most MYDEV_BATCH_MAX */
+	__u32 flags;		/* MYDEV_BATCH_* */
+	__u32 completed;	/* out: ops run */
+	__u32 pad;
+	__u64 ops;		/* user pointer to count struct mydev_op */
+};
+
+#define MYDEV_IOC_MAGIC		'H'
+#define MYDEV_IOC_VERSION	_IOR(MYDEV_IOC_MAGIC, 0, __u32)
+#define MYDEV_IOC_OP		_IOWR(MYDEV_IOC_MAGIC, 1, struct mydev_op)
+#define MYDEV_IOC_BATCH		_IOWR(MYDEV_IOC_MAGIC, 2, struct mydev_batch)
+
+/*
+ * io_uring passthrough (IORING_OP_URING_CMD): sqe->cmd_op is one of the MYDEV_IOC_* commands and
+ * the sqe command area holds struct mydev_uring_cmd with the argument the ioctl would get.
+ * cqe->res is what the ioctl would return, a batch completes as one cqe.
+ */
+struct mydev_uring_cmd {
+	__u64 arg;
+};
+
+#endif /* _MYDEV_H */
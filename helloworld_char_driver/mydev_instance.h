@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Device instances of helloworld_rpi5_char_driver and helloworld_rpi5_class_driver
+ *
+ * num_devices instances, one minor each. every instance has its own cdev, ring and statistics and
+ * nothing is shared between them: no global lock, no common counter, each instance starts on its
+ * own cache line. N processes on N instances never touch each other's data.
+ *
+ * open() looks the instance up from the cdev of the inode and keeps it in file->private_data, all
+ * other fops take it from there. the ring of an instance is one FIFO shared by everybody who opens
+ * that minor (it is a loopback), so there is no other per open state to allocate.
+ *
+ * ring_size can be written at runtime (/sys/module/<module name>/parameters/ring_size), every
+ * instance is resized in place while it is in use (hello_ring_resize()). a size one instance
+ * can't take is refused for all of them.
+ */
+#ifndef _MYDEV_INSTANCE_H
+#define _MYDEV_INSTANCE_H
+
+#include <linux/cdev.h>
+#include <linux/fs.h>
+#include <linux/cache.h>
+#include <linux/debugfs.h>
+
+#include "hello_ring.h"
+#include "mydev_stats.h"
+
+#define MYDEV_MAX_DEVICES	64
+
+struct mydev_instance {
+	struct cdev cdev;
+	struct hello_ring ring;
+	struct mydev_dev_stats stats;
+	unsigned int index;
+} ____cacheline_aligned_in_smp;
+
+static inline int mydev_instance_open(struct inode *inode, struct file *file){
+	file->private_data = container_of(inode->i_cdev, struct mydev_instance, cdev);
+	return 0;
+}
+
+static inline struct mydev_instance *mydev_instance_of(struct file *file){
+	return file->private_data;
+}
+
+/* ring and statistics of one instance, the stats go to <parent>/<name>/stats in debugfs */
+static inline int mydev_instance_init(struct mydev_instance *inst, unsigned int index, size_t ring_size,
+				      const char *name, struct dentry *parent){
+	int ret;
+
+	inst->index = index;
+	/* the ring is allocated once here, read/write never allocate */
+	ret = hello_ring_init(&inst->ring, ring_size);
+	if (ret < 0)
+		return ret;
+
+	ret = mydev_stats_init(&inst->stats, name, parent);
+	if (ret < 0){
+		hello_ring_free(&inst->ring);
+		return ret;
+	}
+	return 0;
+}
+
+/*
+ * runtime change of ring_size, all instances or none: it stops at the first instance that can't
+ * be resized and sets the ones before it back to the old size, so ring_size stays true for every
+ * ring. setting one back can fail as well (it was mapped or filled meanwhile), that instance keeps
+ * the new size and is logged
+ */
+static inline int mydev_instances_resize(struct mydev_instance *insts, unsigned int n, size_t size){
+	size_t old;
+	unsigned int i;
+	int ret = 0, undo;
+
+	if (!n)
+		return 0;
+	/* the instances only ever change together, the first one has the size of all */
+	old = READ_ONCE(insts[0].ring.size);
+
+	for (i = 0; i < n; i++){
+		ret = hello_ring_resize(&insts[i].ring, size);
+		if (ret)
+			break;
+	}
+	if (!ret)
+		return 0;
+
+	while (i--){
+		undo = hello_ring_resize(&insts[i].ring, old);
+		if (undo)
+			pr_warn("mydev%u: ring stays at %zu bytes, setting it back to %zu failed: %d\n",
+				insts[i].index, READ_ONCE(insts[i].ring.size), old, undo);
+	}
+	return ret;
+}
+
+/* the range hello_ring_init() would clamp to, a runtime value outside of it is refused */
+static inline int mydev_parse_ring_size(const char *val, unsigned long *size){
+	int ret = kstrtoul(val, 0, size);
+
+	if (ret)
+		return ret;
+	if (*size < HELLO_RING_MIN_SIZE || *size > HELLO_RING_MAX_SIZE)
+		return -EINVAL;
+	return 0;
+}
+
+static inline void mydev_instance_free(struct mydev_instance *inst){
+	hello_ring_free(&inst->ring);
+	mydev_stats_free(&inst->stats);
+}
+
+#endif /* _MYDEV_INSTANCE_H */
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * ioctl dispatch of the helloworld char drivers (ABI in mydev.h)
+ *
+ * every driver only implements its sub operations in a do_op() callback, the single op and batch
+ * commands around it are the same for all of them. a batch is copied in and out in small chunks on
+ * the stack, nothing is allocated. io_uring commands go through the same dispatch and complete inline
+ * in the submitting task, which has the user memory the argument points to. issued inline
+ * (IO_URING_F_NONBLOCK) an op must not wait for a lock: do_op() gets nonblock and returns -EAGAIN
+ * when the lock is taken, the command then goes back to io_uring which runs it again from an io-wq
+ * worker. only the first op of a batch is tried that way, the ops before it can't be run twice, so
+ * later ops in a batch wait for their lock.
+ */
+#ifndef _MYDEV_IOCTL_H
+#define _MYDEV_IOCTL_H
+
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/minmax.h>
+#include <linux/io_uring/cmd.h>
+
+#include "mydev.h"
+
+#define MYDEV_BATCH_CHUNK	16
+
+/*
+ * runs one op, returns 0 or -errno. the result goes to op->result as well. with nonblock a lock
+ * the op needs is only tried, -EAGAIN if it is taken
+ */
+typedef int (*mydev_do_op_t)(struct file *file, struct mydev_op *op, bool nonblock);
+
+static inline int mydev_run_op(struct file *file, struct mydev_op *op, mydev_do_op_t do_op, bool nonblock){
+	if (op->flags)
+		op->result = -EINVAL;
+	else if (op->code == MYDEV_OP_NOP)
+		op->result = 0;
+	else
+		op->result = do_op(file, op, nonblock);
+	return op->result;
+}
+
+/* -EAGAIN with nonblock when the first op would wait, nothing has been run then */
+static inline long mydev_batch(struct file *file, struct mydev_batch __user *ubatch, mydev_do_op_t do_op,
+			       bool nonblock){
+	struct mydev_op ops[MYDEV_BATCH_CHUNK];
+	struct mydev_op __user *uops;
+	struct mydev_batch batch;
+	u32 done = 0, n, i;
+	bool failed = false, first;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (batch.count > MYDEV_BATCH_MAX || (batch.flags & ~MYDEV_BATCH_CONTINUE) || batch.pad)
+		return -EINVAL;
+	uops = u64_to_user_ptr(batch.ops);
+
+	while (done < batch.count && !failed){
+		n = min_t(u32, batch.count - done, MYDEV_BATCH_CHUNK);
+		if (copy_from_user(ops, uops + done, n * sizeof(ops[0])))
+			return -EFAULT;
+
+		for (i = 0; i < n; i++){
+			first = nonblock && !done && !i;
+			if (mydev_run_op(file, &ops[i], do_op, first) == -EAGAIN && first)
+				return -EAGAIN;
+			if (ops[i].result && !(batch.flags & MYDEV_BATCH_CONTINUE)){
+				failed = true;
+				i++;
+				break;
+			}
+		}
+
+		if (copy_to_user(uops + done, ops, i * sizeof(ops[0])))
+			return -EFAULT;
+		done += i;
+	}
+
+	if (put_user(done, &ubatch->completed))
+		return -EFAULT;
+	return done;
+}
+
+static inline long mydev_dispatch(struct file *file, unsigned int cmd, unsigned long arg, mydev_do_op_t do_op,
+				  bool nonblock){
+	void __user *uarg = (void __user *)arg;
+	struct mydev_op op;
+
+	switch (cmd){
+	case MYDEV_IOC_VERSION:
+		return put_user(MYDEV_ABI_VERSION, (__u32 __user *)uarg);
+	case MYDEV_IOC_OP:
+		if (copy_from_user(&op, uarg, sizeof(op)))
+			return -EFAULT;
+		/* nothing was done, the retry from io-wq copies the op in again */
+		if (mydev_run_op(file, &op, do_op, nonblock) == -EAGAIN && nonblock)
+			return -EAGAIN;
+		if (copy_to_user(uarg, &op, sizeof(op)))
+			return -EFAULT;
+		return op.result;
+	case MYDEV_IOC_BATCH:
+		return mydev_batch(file, uarg, do_op, nonblock);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static inline long mydev_ioctl(struct file *file, unsigned int cmd, unsigned long arg, mydev_do_op_t do_op){
+	return mydev_dispatch(file, cmd, arg, do_op, false);
+}
+
+/* -EAGAIN with IO_URING_F_NONBLOCK only when a lock was taken, io_uring retries from io-wq */
+static inline int mydev_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags, mydev_do_op_t do_op){
+	const struct mydev_uring_cmd *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+
+	return mydev_dispatch(ioucmd->file, ioucmd->cmd_op, READ_ONCE(cmd->arg), do_op,
+			      issue_flags & IO_URING_F_NONBLOCK);
+}
+
+/* MYDEV_OP_GET_STATS, copies the snapshot to the user pointer in op->value */
+static inline int mydev_put_stats(struct mydev_op *op, const struct mydev_stats *stats){
+	if (copy_to_user(u64_to_user_ptr(op->value), stats, sizeof(*stats)))
+		return -EFAULT;
+	return 0;
+}
+
+#endif /* _MYDEV_IOCTL_H */
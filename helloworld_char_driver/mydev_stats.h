@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Statistics of the helloworld char drivers
+ *
+ * per CPU counters of calls, errors and bytes and a log2 histogram of the time spent in the driver
+ * for every operation. the hot path only does this_cpu adds, no lock and no shared cache line,
+ * the CPUs are summed up when somebody looks:
+ *  - /sys/kernel/debug/<module name>[/<device>]/stats, a write to it resets everything
+ *  - MYDEV_OP_GET_STATS / MYDEV_OP_RESET_STATS of the ioctl ABI (mydev.h)
+ *
+ * the time is taken from entering the fop to returning from it, for blocking calls that includes
+ * the wait for data or space. histogram bucket n counts calls which took [2^n, 2^(n+1)) ns, the
+ * last bucket everything above. -EAGAIN is not counted as an error, it is normal for O_NONBLOCK.
+ * a reset racing with updates on other CPUs may leave a few of them in, it is not a snapshot.
+ *
+ * the stats module parameter turns the accounting off and on at runtime
+ * (/sys/module/<module name>/parameters/stats), off the fops don't even read the clock.
+ */
+#ifndef _MYDEV_STATS_H
+#define _MYDEV_STATS_H
+
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/moduleparam.h>
+
+#include "mydev_ioctl.h"
+
+enum mydev_stat_op {
+	MYDEV_STAT_READ,
+	MYDEV_STAT_WRITE,
+	MYDEV_STAT_IOCTL,
+	MYDEV_STAT_OPS,
+};
+
+#define MYDEV_HIST_BUCKETS	32	/* up to ~2 s */
+
+struct mydev_pcpu_stats {
+	u64 calls[MYDEV_STAT_OPS];
+	u64 errors[MYDEV_STAT_OPS];
+	u64 bytes[MYDEV_STAT_OPS];
+	u64 hist[MYDEV_STAT_OPS][MYDEV_HIST_BUCKETS];
+};
+
+struct mydev_dev_stats {
+	struct mydev_pcpu_stats __percpu *pcpu;
+	struct dentry *dir;
+};
+
+static const char * const mydev_stat_names[MYDEV_STAT_OPS] = {
+	[MYDEV_STAT_READ] = "read",
+	[MYDEV_STAT_WRITE] = "write",
+	[MYDEV_STAT_IOCTL] = "ioctl",
+};
+
+static bool mydev_stats_enabled = true;
+module_param_named(stats, mydev_stats_enabled, bool, 0644);
+MODULE_PARM_DESC(stats, "per CPU call counters and latency histograms in debugfs, can be changed at runtime");
+
+/* start of a fop, 0 while the accounting is off */
+static inline ktime_t mydev_stats_start(void){
+	return READ_ONCE(mydev_stats_enabled) ? ktime_get() : 0;
+}
+
+/* ret is what the fop returns, bytes are counted for read and write */
+static inline void mydev_stats_account(struct mydev_dev_stats *st, enum mydev_stat_op op, ktime_t start, long ret){
+	u64 ns;
+	unsigned int bucket;
+
+	if (!start)
+		return;
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	bucket = ns ? min_t(unsigned int, ilog2(ns), MYDEV_HIST_BUCKETS - 1) : 0;
+
+	this_cpu_inc(st->pcpu->calls[op]);
+	this_cpu_inc(st->pcpu->hist[op][bucket]);
+	if (ret < 0){
+		if (ret != -EAGAIN)
+			this_cpu_inc(st->pcpu->errors[op]);
+	} else if (op != MYDEV_STAT_IOCTL){
+		this_cpu_add(st->pcpu->bytes[op], ret);
+	}
+}
+
+static inline void mydev_stats_sum(struct mydev_dev_stats *st, struct mydev_pcpu_stats *sum){
+	struct mydev_pcpu_stats *p;
+	int cpu, op, b;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu){
+		p = per_cpu_ptr(st->pcpu, cpu);
+		for (op = 0; op < MYDEV_STAT_OPS; op++){
+			sum->calls[op] += READ_ONCE(p->calls[op]);
+			sum->errors[op] += READ_ONCE(p->errors[op]);
+			sum->bytes[op] += READ_ONCE(p->bytes[op]);
+			for (b = 0; b < MYDEV_HIST_BUCKETS; b++)
+				sum->hist[op][b] += READ_ONCE(p->hist[op][b]);
+		}
+	}
+}
+
+static inline void mydev_stats_reset(struct mydev_dev_stats *st){
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(st->pcpu, cpu), 0, sizeof(struct mydev_pcpu_stats));
+}
+
+/* "read calls N errors N bytes N" per operation, then the non empty buckets as "<2^n ns>: count" */
+static int mydev_stats_show(struct seq_file *m, void *v){
+	struct mydev_dev_stats *st = m->private;
+	struct mydev_pcpu_stats *sum;
+	int op, b;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+	mydev_stats_sum(st, sum);
+
+	for (op = 0; op < MYDEV_STAT_OPS; op++){
+		seq_printf(m, "%s calls %llu errors %llu bytes %llu\n", mydev_stat_names[op],
+			   sum->calls[op], sum->errors[op], sum->bytes[op]);
+		for (b = 0; b < MYDEV_HIST_BUCKETS; b++){
+			if (sum->hist[op][b])
+				seq_printf(m, "  %12llu ns: %llu\n", 1ULL << b, sum->hist[op][b]);
+		}
+	}
+
+	kfree(sum);
+	return 0;
+}
+
+static int mydev_stats_open(struct inode *inode, struct file *file){
+	return single_open(file, mydev_stats_show, inode->i_private);
+}
+
+static ssize_t mydev_stats_write(struct file *file, const char __user *buff, size_t count, loff_t *ppos){
+	struct seq_file *m = file->private_data;
+
+	mydev_stats_reset(m->private);
+	return count;
+}
+
+static const struct file_operations mydev_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = mydev_stats_open,
+	.read = seq_read,
+	.write = mydev_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* debugfs is optional, the counters work without it. the directory goes to parent, NULL is the root */
+static inline int mydev_stats_init(struct mydev_dev_stats *st, const char *name, struct dentry *parent){
+	st->pcpu = alloc_percpu(struct mydev_pcpu_stats);
+	if (!st->pcpu)
+		return -ENOMEM;
+
+	st->dir = debugfs_create_dir(name, parent);
+	debugfs_create_file("stats", 0600, st->dir, st, &mydev_stats_fops);
+	return 0;
+}
+
+static inline void mydev_stats_free(struct mydev_dev_stats *st){
+	debugfs_remove_recursive(st->dir);
+	free_percpu(st->pcpu);
+}
+
+/* MYDEV_OP_GET_STATS / MYDEV_OP_RESET_STATS, -ENOIOCTLCMD for every other op */
+static inline int mydev_stats_do_op(struct mydev_dev_stats *st, struct mydev_op *op){
+	struct mydev_stats stats = {};
+	struct mydev_pcpu_stats *p;
+	int cpu;
+
+	switch (op->code){
+	case MYDEV_OP_GET_STATS:
+		for_each_possible_cpu(cpu){
+			p = per_cpu_ptr(st->pcpu, cpu);
+			stats.reads += READ_ONCE(p->calls[MYDEV_STAT_READ]);
+			stats.writes += READ_ONCE(p->calls[MYDEV_STAT_WRITE]);
+			stats.bytes_read += READ_ONCE(p->bytes[MYDEV_STAT_READ]);
+			stats.bytes_written += READ_ONCE(p->bytes[MYDEV_STAT_WRITE]);
+		}
+		return mydev_put_stats(op, &stats);
+	case MYDEV_OP_RESET_STATS:
+		mydev_stats_reset(st);
+		return 0;
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
+
+#endif /* _MYDEV_STATS_H */
@@ -16,8 +16,42 @@ static int num = 5;
 /* S_IRUGO: everyone can read the sysfs entry */
 module_param(num, int, S_IRUGO);
 
+/*
+ * a parameter which can be changed while the module is loaded:
+ * module_param_cb(name, ops, arg, perm) with write permission in perm, the set() of ops is called
+ * for "insmod ... level=N" and for every write to /sys/module/<module>/parameters/level, so it can
+ * validate the value and apply it right away. returning an error keeps the old value.
+ * the drivers use this for their tunables (ring_size, stats, ...)
+ */
+static int level = 1;
+
+static int level_set(const char *val, const struct kernel_param *kp){
+	int new_level;
+	int ret;
+
+	ret = kstrtoint(val, 0, &new_level);
+	if (ret)
+		return ret;
+	if (new_level < 0 || new_level > 10)
+		return -EINVAL;
+
+	*(int *)kp->arg = new_level;
+	pr_info("level changed to %d\n", new_level);
+	return 0;
+}
+
+static const struct kernel_param_ops level_ops = {
+	.set = level_set,
+	.get = param_get_int,
+};
+
+/* 0644: everyone can read, root can write */
+module_param_cb(level, &level_ops, &level, 0644);
+MODULE_PARM_DESC(level, "0..10, can be changed at runtime");
+
 static int __init hello_init(void){
 	pr_info("parameter num = %d.\n", num);
+	pr_info("parameter level = %d.\n", level);
 	pr_info("hello from init\n");
 	return 0;
 }
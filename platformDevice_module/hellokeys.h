@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace ABI of hellokeys_rpi5, shared between the driver and the apps in apps/
+ */
+#ifndef _HELLOKEYS_H
+#define _HELLOKEYS_H
+
+#include <linux/types.h>
+
+/*
+ * Key events on /dev/hellokeys
+ *
+ * every read() returns whole events, at least one, blocking until one is queued (or -EAGAIN
+ * with O_NONBLOCK). key is the index of the key node in the DT, counted from 0.
+ * timestamp_ns is CLOCK_MONOTONIC of the first edge of the bounce burst, so it can be compared
+ * with clock_gettime(CLOCK_MONOTONIC) in userspace.
+ */
+#define HELLOKEYS_EDGE_RELEASE	0
+#define HELLOKEYS_EDGE_PRESS	1
+
+struct hellokeys_event {
+	__u64 timestamp_ns;
+	__u16 key;
+	__u8 edge;		/* HELLOKEYS_EDGE_* */
+	__u8 pad[5];
+};
+
+/*
+ * Capture mode on /dev/hellokeys_capture
+ *
+ * edges of the keys selected in capture_pins and samples of the whole bank at sample_rate go to one
+ * preallocated byte ring as a stream of variable length records. the ring can be read() or mmap()ed:
+ * struct hellokeys_capture_ctrl at offset 0, the data at data_offset. head and tail are free running
+ * byte counters, the position in the data is counter & (size - 1). the driver only moves head and
+ * only by whole records, a mapped consumer loads head with acquire semantics, decodes in place and
+ * stores the new tail with release semantics. one consumer at a time, read() or the mapping.
+ * a full ring drops new records, they are counted in lost and announced by the next SYNC.
+ *
+ * every record starts with a tag byte, the top two bits are the type:
+ *   EDGE    tag 00lkkkkk, varint dt                    key k (0..31) went to raw level l
+ *   SAMPLE  tag 01000000, varint dt, varint x          bank value is the previous one ^ x
+ *   SYNC    tag 10000000, __u64 time_ns (le), varint n  absolute time, n records lost before it
+ * dt is the time in ns since the previous record, time_ns is CLOCK_MONOTONIC. varints are LEB128:
+ * 7 bits per byte, low bits first, bit 7 set when another byte follows.
+ * the stream of a capture starts with a SYNC, the bank value is 0 after every SYNC and a SAMPLE is
+ * only written when the value changed, so an idle bank costs nothing.
+ */
+#define HELLOKEYS_REC_TYPE	0xc0
+#define HELLOKEYS_REC_EDGE	0x00
+#define HELLOKEYS_REC_SAMPLE	0x40
+#define HELLOKEYS_REC_SYNC	0x80
+#define HELLOKEYS_REC_LEVEL	0x20	/* EDGE: the level after the edge */
+#define HELLOKEYS_REC_KEY	0x1f	/* EDGE: key index */
+
+struct hellokeys_capture_ctrl {
+	__u32 head;		/* moved by the driver only */
+	__u32 size;		/* data area size in bytes, power of two */
+	__u32 data_offset;	/* offset of the data area in the mapping */
+	__u32 lost;		/* records dropped since the driver was loaded */
+	__u32 pad0[12];		/* tail on its own 64 byte cache line */
+	__u32 tail;		/* moved by the consumer */
+	__u32 pad1[15];
+};
+
+#endif /* _HELLOKEYS_H */
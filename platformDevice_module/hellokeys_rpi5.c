@@ -3,6 +3,28 @@
 #include <linux/platform_device.h>
 #include <linux/of.h>
 #include <linux/miscdevice.h>
+#include <linux/gpio/consumer.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/kfifo.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/kref.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/input.h>
+#include <linux/io.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/bitmap.h>
+#include <linux/sizes.h>
+
+#include "hellokeys.h"
 
 /* 
  * if we simply compile and run the driver then it will not execute, as the probe() function should 
@@ -28,52 +50,1060 @@
  *
  */
 
-static int my_dev_open(struct inode *inode, struct file *file){
-	pr_info("my_dev_open() is called\n");
+/*
+ * hellokeys: push buttons on GPIO inputs, one DT child node per key
+ *
+ *  hellokeys {
+ *	compatible = "arrow,hellokeys";
+ *	debounce-interval = <5>;		(ms, optional, default for all keys)
+ *
+ *	key_up {
+ *		label = "up";
+ *		gpios = <&rp1_gpio 23 GPIO_ACTIVE_LOW>;
+ *		linux,code = <103>;		(KEY_UP, optional, reports the key through input)
+ *		debounce-interval = <10>;	(ms, optional, this key only)
+ *	};
+ *  };
+ *
+ * both edges of every key raise an interrupt. the hard handler only takes the timestamp, the
+ * threaded handler debounces: in hardware when the GPIO controller supports it
+ * (gpiod_set_debounce()), else with a per key hrtimer which is pushed out on every bounce and
+ * samples the pin once the line was quiet for the debounce interval. a debounce-interval of 0
+ * turns debouncing off for lines which don't bounce (gpio-sim), the thread reads the pin then.
+ * a settled change of a key becomes one struct hellokeys_event (hellokeys.h) in a kfifo, which
+ * /dev/hellokeys hands out through blocking read() and poll(). keys with a linux,code are also
+ * reported as EV_KEY through an input device, so evdev/libinput consumers get them directly.
+ *
+ * capture mode (/dev/hellokeys_capture) is a small logic analyzer on the same lines: the hard
+ * handler also records every edge of the selected keys, undebounced, and an hrtimer samples the
+ * whole bank at a fixed rate (the RP1 RIO IN register when the node has a reg, else the key lines).
+ * both go to one preallocated ring as delta-encoded records (hellokeys.h), read() or mmap() it.
+ *
+ * detailed explanation: KEYS_README
+ */
+
+#define HELLOKEYS_DEBOUNCE_MS	5
+#define HELLOKEYS_DEBOUNCE_MAX_MS	1000
+#define HELLOKEYS_FIFO_EVENTS	256	/* power of two */
+
+#define HELLOKEYS_SAMPLE_MAX_HZ	100000
+#define HELLOKEYS_CAPTURE_KEYS	32	/* key field of an EDGE record, bits of a SAMPLE */
+#define HELLOKEYS_REC_MAX	32	/* a SYNC and the record behind it */
+
+/* RP1 RIO block of a GPIO bank, IN is the level of all its pins */
+#define RP1_RIO_IN	0x8
+
+/* the capture ring is allocated once at probe, nothing is allocated while capturing */
+static unsigned int capture_kb = 1024;
+module_param(capture_kb, uint, 0444);
+MODULE_PARM_DESC(capture_kb, "size of the capture ring in KiB, rounded up to a power of two (4 .. 65536)");
+
+struct hellokeys_drvdata;
+
+/*
+ * the wait queues of /dev/hellokeys and /dev/hellokeys_capture. an open file can outlive the
+ * driver (unbind with a node open, a poll entry stays on the queue until the file is closed), so
+ * this is not part of drvdata: it is the private_data of every open file, each of them and the
+ * driver hold a reference. the fops hold lock for reading while they use drvdata, remove sets
+ * gone, wakes everyone (they fail with -ENODEV then) and takes lock for writing to wait for them
+ */
+struct hellokeys_waiters {
+	struct kref ref;
+	wait_queue_head_t wait;
+	wait_queue_head_t capture_wait;
+	struct rw_semaphore lock;
+	bool gone;
+	struct hellokeys_drvdata *drvdata;
+};
+
+struct hellokeys_key {
+	struct hellokeys_drvdata *drvdata;
+	struct gpio_desc *gpiod;
+	const char *label;
+	unsigned int index;
+	int irq;
+	u32 code;		/* input key code, KEY_RESERVED when the key is not reported to input */
+	unsigned int debounce_us;
+	bool hw_debounce;
+	struct hrtimer debounce_timer;
+	atomic_t pending;	/* a bounce burst is being debounced, stamp is its first edge */
+	ktime_t stamp;
+	int last;		/* last reported value, 1 = pressed */
+	bool can_sleep;
+	int cap_level;		/* raw level for the capture, only tracked on lines which may sleep */
+};
+
+struct hellokeys_drvdata {
+	struct miscdevice misc;
+	struct hellokeys_key *keys;
+	unsigned int num_keys;
+	struct input_dev *input;
+
+	/*
+	 * the keys (timers and irq threads on any CPU) are serialized by events_lock on the way in,
+	 * this also keeps the timestamp, EV_KEY and EV_SYN of one key together on the input device.
+	 * readers are serialized by read_lock and never take events_lock: kfifo needs no lock between
+	 * one producer and one consumer
+	 */
+	DECLARE_KFIFO(events, struct hellokeys_event, HELLOKEYS_FIFO_EVENTS);
+	spinlock_t events_lock;
+	struct mutex read_lock;
+	struct hellokeys_waiters *waiters;	/* wait is the queue of the event readers */
+	atomic_t dropped;
+
+	/* serializes writers of debounce_ms, the keys are quiesced while it changes */
+	struct mutex debounce_lock;
+	u32 debounce_ms;
+
+	/*
+	 * capture ring: records are added from hard irq context (key irqs, sample_timer) under
+	 * capture_lock and only as a whole, cap_head is published to cap_ctrl->head afterwards.
+	 * readers are serialized by capture_read_lock and never take capture_lock, the same single
+	 * producer / single consumer scheme as the events kfifo. capture_ctl_lock serializes the
+	 * attribute writers. cap_sync: the next record is preceded by a SYNC, set when the capture is
+	 * (re)configured and after a record was lost
+	 */
+	struct miscdevice capture_misc;
+	struct hellokeys_capture_ctrl *cap_ctrl;	/* first page of the vmalloc_user() area */
+	u8 *cap_data;
+	u32 cap_size;
+	u32 cap_head;
+	ktime_t cap_last;	/* time of the last record, dt of the next one is taken from it */
+	u32 cap_lost;		/* records lost since the last SYNC */
+	bool cap_sync;
+	spinlock_t capture_lock;
+	struct mutex capture_read_lock;
+	struct mutex capture_ctl_lock;
+	unsigned long capture_pins;	/* keys whose edges are recorded */
+
+	/* bank sampler, rio is the RP1 RIO block from reg, without it the key lines are read */
+	struct hrtimer sample_timer;
+	u32 sample_rate;
+	ktime_t sample_period;
+	u32 sample_prev;	/* bank value of the last SAMPLE, 0 after a SYNC */
+	void __iomem *rio;
+	struct gpio_desc **descs;
+	unsigned long *sample_values;
+	unsigned int sample_keys;
+	bool keys_can_sleep;
+};
+
+/*
+ * queues a settled state of a key and reports it to input, called from the debounce timer or
+ * the irq thread. the input event carries the edge timestamp instead of the time of the report.
+ */
+static void hellokeys_report(struct hellokeys_key *key, int value, ktime_t stamp){
+	struct hellokeys_drvdata *drvdata = key->drvdata;
+	struct hellokeys_event event = {
+		.timestamp_ns = ktime_to_ns(stamp),
+		.key = key->index,
+		.edge = value ? HELLOKEYS_EDGE_PRESS : HELLOKEYS_EDGE_RELEASE,
+	};
+	unsigned long flags;
+	bool queued;
+
+	/* the line bounced back to where it was */
+	if (value == key->last)
+		return;
+	key->last = value;
+
+	spin_lock_irqsave(&drvdata->events_lock, flags);
+	queued = kfifo_put(&drvdata->events, event);
+	if (key->code != KEY_RESERVED){
+		input_set_timestamp(drvdata->input, stamp);
+		input_report_key(drvdata->input, key->code, value);
+		input_sync(drvdata->input);
+	}
+	spin_unlock_irqrestore(&drvdata->events_lock, flags);
+
+	if (!queued){
+		if (atomic_inc_return(&drvdata->dropped) == 1)
+			pr_warn("hellokeys: event fifo full, dropping events\n");
+		return;
+	}
+	wake_up_interruptible(&drvdata->waiters->wait);
+}
+
+/* LEB128, returns the number of bytes */
+static unsigned int hellokeys_put_varint(u8 *p, u64 value){
+	unsigned int n = 0;
+
+	while (value >= 0x80){
+		p[n++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	p[n++] = value;
+	return n;
+}
+
+/*
+ * caller holds capture_lock, adds one record (with the SYNC in front of it if one is due) or drops
+ * it when the ring has no room. value is the bank of a SAMPLE, which is skipped when it didn't
+ * change. the stream never goes back in time: stamps older than the last record (an edge stamped
+ * on one CPU while the sampler wrote on another) are recorded with dt 0
+ */
+static void hellokeys_capture_record(struct hellokeys_drvdata *drvdata, ktime_t stamp, u8 tag, u32 value){
+	struct hellokeys_capture_ctrl *ctrl = drvdata->cap_ctrl;
+	bool sample = (tag & HELLOKEYS_REC_TYPE) == HELLOKEYS_REC_SAMPLE;
+	u32 mask = drvdata->cap_size - 1;
+	u8 rec[HELLOKEYS_REC_MAX];
+	unsigned int len = 0, i;
+	u32 prev, used;
+	ktime_t last;
+	u64 ns;
+
+	prev = drvdata->cap_sync ? 0 : drvdata->sample_prev;
+	if (sample && value == prev)
+		return;
+
+	last = drvdata->cap_last;
+	if (ktime_before(stamp, last))
+		stamp = last;
+	if (drvdata->cap_sync){
+		ns = ktime_to_ns(stamp);
+		rec[len++] = HELLOKEYS_REC_SYNC;
+		for (i = 0; i < sizeof(ns); i++)
+			rec[len++] = ns >> (8 * i);
+		len += hellokeys_put_varint(rec + len, drvdata->cap_lost);
+		last = stamp;
+	}
+	rec[len++] = tag;
+	len += hellokeys_put_varint(rec + len, ktime_to_ns(ktime_sub(stamp, last)));
+	if (sample)
+		len += hellokeys_put_varint(rec + len, value ^ prev);
+
+	/* a bogus tail from the mapping means no room */
+	used = drvdata->cap_head - smp_load_acquire(&ctrl->tail);
+	if (used > drvdata->cap_size || drvdata->cap_size - used < len){
+		drvdata->cap_lost++;
+		WRITE_ONCE(ctrl->lost, ctrl->lost + 1);
+		drvdata->cap_sync = true;
+		return;
+	}
+
+	for (i = 0; i < len; i++)
+		drvdata->cap_data[(drvdata->cap_head + i) & mask] = rec[i];
+	drvdata->cap_head += len;
+	drvdata->cap_last = stamp;
+	if (drvdata->cap_sync){
+		drvdata->cap_sync = false;
+		drvdata->cap_lost = 0;
+	}
+	if (sample)
+		drvdata->sample_prev = value;
+
+	/*
+	 * the record is in place before the reader can see it. every record checks for a sleeper, a
+	 * reader may have emptied the ring and gone to sleep since tail was loaded above.
+	 * wq_has_sleeper() has the barrier between the head store and the waitqueue check, it pairs
+	 * with prepare_to_wait() in wait_event and the smp_mb() in hellokeys_capture_poll()
+	 */
+	smp_store_release(&ctrl->head, drvdata->cap_head);
+	if (wq_has_sleeper(&drvdata->waiters->capture_wait))
+		wake_up_interruptible(&drvdata->waiters->capture_wait);
+}
+
+/* hard irq context, stamp is the time the handler was entered */
+static void hellokeys_capture_edge(struct hellokeys_key *key, ktime_t stamp){
+	struct hellokeys_drvdata *drvdata = key->drvdata;
+	unsigned long flags;
+	int level;
+
+	/* a sleeping line can't be read here, every irq is an edge so its level just toggles */
+	if (key->can_sleep)
+		level = key->cap_level = !key->cap_level;
+	else
+		level = gpiod_get_raw_value(key->gpiod);
+
+	spin_lock_irqsave(&drvdata->capture_lock, flags);
+	hellokeys_capture_record(drvdata, stamp, HELLOKEYS_REC_EDGE | (level > 0 ? HELLOKEYS_REC_LEVEL : 0) |
+				 key->index, 0);
+	spin_unlock_irqrestore(&drvdata->capture_lock, flags);
+}
+
+/* raw levels of the bank, bit n is pin n of the RIO block or key n without it */
+static int hellokeys_sample_bank(struct hellokeys_drvdata *drvdata, u32 *value){
+	int ret_val;
+
+	if (drvdata->rio){
+		*value = readl(drvdata->rio + RP1_RIO_IN);
+		return 0;
+	}
+	ret_val = gpiod_get_raw_array_value(drvdata->sample_keys, drvdata->descs, NULL, drvdata->sample_values);
+	if (ret_val)
+		return ret_val;
+	*value = bitmap_read(drvdata->sample_values, 0, drvdata->sample_keys);
 	return 0;
 }
 
-static int my_dev_close(struct inode *inode, struct file *file){
-	pr_info("my_dev_close() is called\n");
+/* fixed rate, ticks missed because the CPU was busy are skipped rather than caught up with */
+static enum hrtimer_restart hellokeys_sample_timer(struct hrtimer *timer){
+	struct hellokeys_drvdata *drvdata = container_of(timer, struct hellokeys_drvdata, sample_timer);
+	ktime_t stamp = ktime_get();
+	unsigned long flags;
+	u32 value;
+
+	if (!hellokeys_sample_bank(drvdata, &value)){
+		spin_lock_irqsave(&drvdata->capture_lock, flags);
+		hellokeys_capture_record(drvdata, stamp, HELLOKEYS_REC_SAMPLE, value);
+		spin_unlock_irqrestore(&drvdata->capture_lock, flags);
+	}
+	hrtimer_forward_now(timer, drvdata->sample_period);
+	return HRTIMER_RESTART;
+}
+
+static enum hrtimer_restart hellokeys_debounce_timer(struct hrtimer *timer){
+	struct hellokeys_key *key = container_of(timer, struct hellokeys_key, debounce_timer);
+	ktime_t stamp = key->stamp;
+	int value;
+
+	/* clear first, an edge from here on starts a new burst with its own timestamp */
+	atomic_set(&key->pending, 0);
+	value = gpiod_get_value(key->gpiod);
+	if (value >= 0)
+		hellokeys_report(key, value, stamp);
+	return HRTIMER_NORESTART;
+}
+
+/* an edge as seen by the hard handler, now is the time it was entered */
+static void hellokeys_edge(struct hellokeys_key *key, ktime_t now){
+	/* the capture sees every edge, before the debounce */
+	if (key->index < HELLOKEYS_CAPTURE_KEYS && test_bit(key->index, &key->drvdata->capture_pins))
+		hellokeys_capture_edge(key, now);
+	if (!atomic_xchg(&key->pending, 1))
+		key->stamp = now;
+}
+
+static irqreturn_t hellokeys_isr(int irq, void *dev_id){
+	hellokeys_edge(dev_id, ktime_get());
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t hellokeys_irq_thread(int irq, void *dev_id){
+	struct hellokeys_key *key = dev_id;
+	ktime_t stamp;
+	int value;
+
+	/*
+	 * nested irqs (keys on an i2c/spi expander) only run this thread, the hard handler never saw
+	 * the edge and key->stamp is the one of an older edge. the edge is taken here then, later by
+	 * the expander's irq latency. a bounce within a burst still finds pending set, so such keys
+	 * capture the first edge of a burst only
+	 */
+	if (!atomic_read(&key->pending))
+		hellokeys_edge(key, ktime_get());
+
+	if (key->debounce_us && !key->hw_debounce){
+		/* every further bounce pushes the sample point out again */
+		hrtimer_start(&key->debounce_timer, us_to_ktime(key->debounce_us), HRTIMER_MODE_REL);
+		return IRQ_HANDLED;
+	}
+
+	/* the controller already filtered the bounces (or there are none), the line is settled */
+	stamp = key->stamp;
+	atomic_set(&key->pending, 0);
+	value = gpiod_get_value_cansleep(key->gpiod);
+	if (value >= 0)
+		hellokeys_report(key, value, stamp);
+	return IRQ_HANDLED;
+}
+
+static void hellokeys_waiters_release(struct kref *ref){
+	kfree(container_of(ref, struct hellokeys_waiters, ref));
+}
+
+/* devm action, the driver's reference. registered before the irqs, so it runs after they are freed */
+static void hellokeys_waiters_put(void *data){
+	struct hellokeys_waiters *waiters = data;
+
+	kref_put(&waiters->ref, hellokeys_waiters_release);
+}
+
+/*
+ * called from remove once the nodes are gone. readers and pollers still inside are woken and
+ * finish before drvdata goes away, the ones coming later see gone and never touch it
+ */
+static void hellokeys_waiters_gone(struct hellokeys_waiters *waiters){
+	WRITE_ONCE(waiters->gone, true);
+	wake_up_interruptible_all(&waiters->wait);
+	wake_up_interruptible_all(&waiters->capture_wait);
+	down_write(&waiters->lock);
+	up_write(&waiters->lock);
+}
+
+/* NULL when the driver is gone, otherwise drvdata stays until hellokeys_leave() */
+static struct hellokeys_drvdata *hellokeys_enter(struct file *file){
+	struct hellokeys_waiters *waiters = file->private_data;
+
+	down_read(&waiters->lock);
+	if (!READ_ONCE(waiters->gone))
+		return waiters->drvdata;
+	up_read(&waiters->lock);
+	return NULL;
+}
+
+static void hellokeys_leave(struct file *file){
+	struct hellokeys_waiters *waiters = file->private_data;
+
+	up_read(&waiters->lock);
+}
+
+/* both nodes, misc_open() runs this under misc_mtx so the driver can't be removed meanwhile */
+static int hellokeys_open_waiters(struct file *file, struct hellokeys_drvdata *drvdata){
+	kref_get(&drvdata->waiters->ref);
+	file->private_data = drvdata->waiters;
 	return 0;
 }
 
-static long my_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
-	pr_info("my_dev_ioctl() is called, cmd=%d, arg=%ld\n", cmd, arg);
+static int hellokeys_open(struct inode *inode, struct file *file){
+	return hellokeys_open_waiters(file, container_of(file->private_data, struct hellokeys_drvdata, misc));
+}
+
+static int hellokeys_release(struct inode *inode, struct file *file){
+	struct hellokeys_waiters *waiters = file->private_data;
+
+	kref_put(&waiters->ref, hellokeys_waiters_release);
 	return 0;
 }
 
-static const struct file_operations my_dev_fops = {
+static ssize_t hellokeys_do_read(struct file *file, struct hellokeys_drvdata *drvdata, char __user *buff, size_t count){
+	struct hellokeys_waiters *waiters = drvdata->waiters;
+	unsigned int copied;
+	int ret_val;
+
+	if (count < sizeof(struct hellokeys_event))
+		return -EINVAL;
+
+	for (;;){
+		if (mutex_lock_interruptible(&drvdata->read_lock))
+			return -ERESTARTSYS;
+		if (!kfifo_is_empty(&drvdata->events))
+			break;
+		mutex_unlock(&drvdata->read_lock);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret_val = wait_event_interruptible(waiters->wait,
+						   READ_ONCE(waiters->gone) || !kfifo_is_empty(&drvdata->events));
+		if (ret_val)
+			return ret_val;
+		if (READ_ONCE(waiters->gone))
+			return -ENODEV;
+	}
+
+	/* kfifo_to_user() only moves whole events for a fifo of structs */
+	ret_val = kfifo_to_user(&drvdata->events, buff, count, &copied);
+	mutex_unlock(&drvdata->read_lock);
+
+	return ret_val ? ret_val : copied;
+}
+
+static ssize_t hellokeys_read(struct file *file, char __user *buff, size_t count, loff_t *ppos){
+	struct hellokeys_drvdata *drvdata = hellokeys_enter(file);
+	ssize_t ret_val;
+
+	if (!drvdata)
+		return -ENODEV;
+	ret_val = hellokeys_do_read(file, drvdata, buff, count);
+	hellokeys_leave(file);
+	return ret_val;
+}
+
+static __poll_t hellokeys_poll(struct file *file, poll_table *wait){
+	struct hellokeys_waiters *waiters = file->private_data;
+	struct hellokeys_drvdata *drvdata;
+	__poll_t mask = 0;
+
+	poll_wait(file, &waiters->wait, wait);
+	drvdata = hellokeys_enter(file);
+	if (!drvdata)
+		return EPOLLERR | EPOLLHUP;
+	if (!kfifo_is_empty(&drvdata->events))
+		mask = EPOLLIN | EPOLLRDNORM;
+	hellokeys_leave(file);
+	return mask;
+}
+
+static const struct file_operations hellokeys_fops = {
+	.owner = THIS_MODULE,
+	.open = hellokeys_open,
+	.release = hellokeys_release,
+	.read = hellokeys_read,
+	.poll = hellokeys_poll,
+	.llseek = noop_llseek,
+};
+
+static ssize_t dropped_show(struct device *dev, struct device_attribute *attr, char *buf){
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct hellokeys_drvdata *drvdata = container_of(misc, struct hellokeys_drvdata, misc);
+
+	return sysfs_emit(buf, "%d\n", atomic_read(&drvdata->dropped));
+}
+static DEVICE_ATTR_RO(dropped);
+
+/*
+ * new debounce interval of one key at runtime. its irq is disabled (which waits for the thread)
+ * and the timer cancelled, so nothing looks at the key meanwhile. a burst cut short by this is
+ * finished by sampling the pin right away
+ */
+static int hellokeys_set_debounce(struct hellokeys_key *key, unsigned int debounce_us){
+	bool hw_debounce;
+	int value, ret_val = 0;
+
+	disable_irq(key->irq);
+	hrtimer_cancel(&key->debounce_timer);
+
+	hw_debounce = debounce_us && !gpiod_set_debounce(key->gpiod, debounce_us);
+	if (debounce_us && !hw_debounce && gpiod_cansleep(key->gpiod)){
+		ret_val = -EINVAL;
+	} else {
+		/*
+		 * a filter set up earlier would stay in the controller under the software or no
+		 * debounce path and hide the bounces (capture mode with debounce_ms 0), so it is
+		 * switched off. controllers without hardware debounce just refuse that
+		 */
+		if (!hw_debounce)
+			gpiod_set_debounce(key->gpiod, 0);
+		key->debounce_us = debounce_us;
+		key->hw_debounce = hw_debounce;
+	}
+
+	atomic_set(&key->pending, 0);
+	value = gpiod_get_value_cansleep(key->gpiod);
+	if (value >= 0)
+		hellokeys_report(key, value, ktime_get());
+	enable_irq(key->irq);
+	return ret_val;
+}
+
+static ssize_t debounce_ms_show(struct device *dev, struct device_attribute *attr, char *buf){
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct hellokeys_drvdata *drvdata = container_of(misc, struct hellokeys_drvdata, misc);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(drvdata->debounce_ms));
+}
+
+/*
+ * sets every key, also the ones with their own debounce-interval in the DT. whether a sleeping
+ * line takes it is only known once its controller was asked, so on a refusal the keys already
+ * set go back to their old interval and debounce_ms stays what all keys have
+ */
+static ssize_t debounce_ms_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct hellokeys_drvdata *drvdata = container_of(misc, struct hellokeys_drvdata, misc);
+	unsigned int *old_us;
+	unsigned int i;
+	u32 debounce_ms;
+	int ret_val;
+
+	ret_val = kstrtou32(buf, 0, &debounce_ms);
+	if (ret_val)
+		return ret_val;
+	if (debounce_ms > HELLOKEYS_DEBOUNCE_MAX_MS)
+		return -EINVAL;
+	old_us = kmalloc_array(drvdata->num_keys, sizeof(*old_us), GFP_KERNEL);
+	if (!old_us)
+		return -ENOMEM;
+
+	mutex_lock(&drvdata->debounce_lock);
+	for (i = 0; i < drvdata->num_keys; i++){
+		old_us[i] = drvdata->keys[i].debounce_us;
+		ret_val = hellokeys_set_debounce(&drvdata->keys[i], debounce_ms * USEC_PER_MSEC);
+		if (ret_val)
+			break;
+	}
+	if (ret_val){
+		/* the old intervals worked before, setting them again does not fail */
+		while (i--)
+			hellokeys_set_debounce(&drvdata->keys[i], old_us[i]);
+	} else {
+		WRITE_ONCE(drvdata->debounce_ms, debounce_ms);
+	}
+	mutex_unlock(&drvdata->debounce_lock);
+	kfree(old_us);
+
+	return ret_val ? ret_val : count;
+}
+static DEVICE_ATTR_RW(debounce_ms);
+
+static struct attribute *hellokeys_attrs[] = {
+	&dev_attr_dropped.attr,
+	&dev_attr_debounce_ms.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(hellokeys);
+
+/* bytes a capture reader can take, a mapped consumer may have stored any tail */
+static u32 hellokeys_capture_used(struct hellokeys_drvdata *drvdata){
+	struct hellokeys_capture_ctrl *ctrl = drvdata->cap_ctrl;
+
+	return min(smp_load_acquire(&ctrl->head) - READ_ONCE(ctrl->tail), drvdata->cap_size);
+}
+
+static int hellokeys_capture_open(struct inode *inode, struct file *file){
+	return hellokeys_open_waiters(file, container_of(file->private_data, struct hellokeys_drvdata, capture_misc));
+}
+
+/* the stream is a byte stream, a read() may end in the middle of a record */
+static ssize_t hellokeys_capture_do_read(struct file *file, struct hellokeys_drvdata *drvdata, char __user *buff,
+					 size_t count){
+	struct hellokeys_waiters *waiters = drvdata->waiters;
+	struct hellokeys_capture_ctrl *ctrl = drvdata->cap_ctrl;
+	size_t len, off, first;
+	u32 tail;
+	int ret_val;
+
+	if (!count)
+		return 0;
+
+	for (;;){
+		if (mutex_lock_interruptible(&drvdata->capture_read_lock))
+			return -ERESTARTSYS;
+		if (hellokeys_capture_used(drvdata))
+			break;
+		mutex_unlock(&drvdata->capture_read_lock);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret_val = wait_event_interruptible(waiters->capture_wait,
+						   READ_ONCE(waiters->gone) || hellokeys_capture_used(drvdata));
+		if (ret_val)
+			return ret_val;
+		if (READ_ONCE(waiters->gone))
+			return -ENODEV;
+	}
+
+	len = min_t(size_t, count, hellokeys_capture_used(drvdata));
+	tail = READ_ONCE(ctrl->tail);
+	off = tail & (drvdata->cap_size - 1);
+	first = min_t(size_t, len, drvdata->cap_size - off);
+	ret_val = 0;
+	if (copy_to_user(buff, drvdata->cap_data + off, first) ||
+	    copy_to_user(buff + first, drvdata->cap_data, len - first))
+		ret_val = -EFAULT;
+	else
+		/* the data is copied out before the irqs may reuse the space */
+		smp_store_release(&ctrl->tail, tail + len);
+	mutex_unlock(&drvdata->capture_read_lock);
+
+	return ret_val ? ret_val : len;
+}
+
+static ssize_t hellokeys_capture_read(struct file *file, char __user *buff, size_t count, loff_t *ppos){
+	struct hellokeys_drvdata *drvdata = hellokeys_enter(file);
+	ssize_t ret_val;
+
+	if (!drvdata)
+		return -ENODEV;
+	ret_val = hellokeys_capture_do_read(file, drvdata, buff, count);
+	hellokeys_leave(file);
+	return ret_val;
+}
+
+static __poll_t hellokeys_capture_poll(struct file *file, poll_table *wait){
+	struct hellokeys_waiters *waiters = file->private_data;
+	struct hellokeys_drvdata *drvdata;
+	__poll_t mask = 0;
+
+	poll_wait(file, &waiters->capture_wait, wait);
+	/* queued before head is checked, pairs with wq_has_sleeper() in hellokeys_capture_record() */
+	smp_mb();
+	drvdata = hellokeys_enter(file);
+	if (!drvdata)
+		return EPOLLERR | EPOLLHUP;
+	if (hellokeys_capture_used(drvdata))
+		mask = EPOLLIN | EPOLLRDNORM;
+	hellokeys_leave(file);
+	return mask;
+}
+
+/*
+ * the control page at offset 0 and the data behind it, the whole area or a part of it from the
+ * start. the mapping holds the pages, it stays valid after the driver has freed the ring
+ */
+static int hellokeys_capture_mmap(struct file *file, struct vm_area_struct *vma){
+	struct hellokeys_drvdata *drvdata = hellokeys_enter(file);
+	int ret_val;
+
+	if (!drvdata)
+		return -ENODEV;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE + drvdata->cap_size)
+		ret_val = -EINVAL;
+	else
+		/* sets VM_DONTEXPAND | VM_DONTDUMP */
+		ret_val = remap_vmalloc_range(vma, drvdata->cap_ctrl, 0);
+	hellokeys_leave(file);
+	return ret_val;
+}
+
+static const struct file_operations hellokeys_capture_fops = {
 	.owner = THIS_MODULE,
-	.open = my_dev_open,
-	.release = my_dev_close,
-	.unlocked_ioctl = my_dev_ioctl,
+	.open = hellokeys_capture_open,
+	.release = hellokeys_release,
+	.read = hellokeys_capture_read,
+	.poll = hellokeys_capture_poll,
+	.mmap = hellokeys_capture_mmap,
+	.llseek = noop_llseek,
 };
 
-static struct miscdevice helloworld_miscdevice = {
-	.minor = MISC_DYNAMIC_MINOR,
-	.name = "mydev",
-	.fops = &my_dev_fops,
+static ssize_t capture_pins_show(struct device *dev, struct device_attribute *attr, char *buf){
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct hellokeys_drvdata *drvdata = container_of(misc, struct hellokeys_drvdata, capture_misc);
+
+	return sysfs_emit(buf, "%#lx\n", READ_ONCE(drvdata->capture_pins));
+}
+
+/*
+ * mask of the keys whose edges are recorded, bit n is key n. the level of a newly selected key on
+ * a sleeping line is read here, its irqs only toggle it from then on
+ */
+static ssize_t capture_pins_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct hellokeys_drvdata *drvdata = container_of(misc, struct hellokeys_drvdata, capture_misc);
+	unsigned int n = min_t(unsigned int, drvdata->num_keys, HELLOKEYS_CAPTURE_KEYS);
+	struct hellokeys_key *key;
+	unsigned long pins;
+	unsigned int i;
+	int ret_val;
+
+	ret_val = kstrtoul(buf, 0, &pins);
+	if (ret_val)
+		return ret_val;
+	if (pins & ~GENMASK(n - 1, 0))
+		return -EINVAL;
+
+	mutex_lock(&drvdata->capture_ctl_lock);
+	for (i = 0; i < n; i++){
+		key = &drvdata->keys[i];
+		if (!(pins & BIT(i)) || test_bit(i, &drvdata->capture_pins) || !key->can_sleep)
+			continue;
+		ret_val = gpiod_get_raw_value_cansleep(key->gpiod);
+		if (ret_val < 0)
+			goto out;
+		key->cap_level = ret_val;
+	}
+	ret_val = 0;
+
+	spin_lock_irq(&drvdata->capture_lock);
+	WRITE_ONCE(drvdata->capture_pins, pins);
+	drvdata->cap_sync = true;
+	spin_unlock_irq(&drvdata->capture_lock);
+out:
+	mutex_unlock(&drvdata->capture_ctl_lock);
+	return ret_val ? ret_val : count;
+}
+static DEVICE_ATTR_RW(capture_pins);
+
+static ssize_t sample_rate_show(struct device *dev, struct device_attribute *attr, char *buf){
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct hellokeys_drvdata *drvdata = container_of(misc, struct hellokeys_drvdata, capture_misc);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(drvdata->sample_rate));
+}
+
+/* Hz, 0 stops the sampler. the timer reads the bank in hard irq context, sleeping lines need a reg */
+static ssize_t sample_rate_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct hellokeys_drvdata *drvdata = container_of(misc, struct hellokeys_drvdata, capture_misc);
+	u32 rate;
+	int ret_val;
+
+	ret_val = kstrtou32(buf, 0, &rate);
+	if (ret_val)
+		return ret_val;
+	if (rate > HELLOKEYS_SAMPLE_MAX_HZ)
+		return -EINVAL;
+	if (rate && !drvdata->rio && drvdata->keys_can_sleep)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&drvdata->capture_ctl_lock);
+	hrtimer_cancel(&drvdata->sample_timer);
+	spin_lock_irq(&drvdata->capture_lock);
+	WRITE_ONCE(drvdata->sample_rate, rate);
+	if (rate)
+		drvdata->sample_period = ns_to_ktime(NSEC_PER_SEC / rate);
+	drvdata->cap_sync = true;
+	spin_unlock_irq(&drvdata->capture_lock);
+	if (rate)
+		hrtimer_start(&drvdata->sample_timer, drvdata->sample_period, HRTIMER_MODE_REL);
+	mutex_unlock(&drvdata->capture_ctl_lock);
+
+	return count;
+}
+static DEVICE_ATTR_RW(sample_rate);
+
+static ssize_t lost_show(struct device *dev, struct device_attribute *attr, char *buf){
+	struct miscdevice *misc = dev_get_drvdata(dev);
+	struct hellokeys_drvdata *drvdata = container_of(misc, struct hellokeys_drvdata, capture_misc);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(drvdata->cap_ctrl->lost));
+}
+static DEVICE_ATTR_RO(lost);
+
+static struct attribute *hellokeys_capture_attrs[] = {
+	&dev_attr_capture_pins.attr,
+	&dev_attr_sample_rate.attr,
+	&dev_attr_lost.attr,
+	NULL,
 };
+ATTRIBUTE_GROUPS(hellokeys_capture);
+
+/* runs after the irq was freed (devm actions run in reverse order), so nothing re-arms the timer */
+static void hellokeys_cancel_timer(void *data){
+	struct hellokeys_key *key = data;
+
+	hrtimer_cancel(&key->debounce_timer);
+}
+
+/* runs before the ring is freed and after the sample_rate attribute is gone */
+static void hellokeys_cancel_sampler(void *data){
+	struct hellokeys_drvdata *drvdata = data;
+
+	hrtimer_cancel(&drvdata->sample_timer);
+}
+
+static void hellokeys_capture_free(void *data){
+	vfree(data);
+}
+
+/*
+ * the capture ring, allocated before the irqs are requested so that devm frees it after them.
+ * the optional reg of the hellokeys node is the RIO block of the bank the sampler reads
+ */
+static int hellokeys_capture_init(struct platform_device *pdev, struct hellokeys_drvdata *drvdata){
+	struct device *dev = &pdev->dev;
+	struct resource *res;
+	size_t size;
+	int ret_val;
+
+	spin_lock_init(&drvdata->capture_lock);
+	mutex_init(&drvdata->capture_read_lock);
+	mutex_init(&drvdata->capture_ctl_lock);
+	drvdata->cap_sync = true;
+
+	size = roundup_pow_of_two(clamp_t(size_t, (size_t)capture_kb * SZ_1K, SZ_4K, SZ_64M));
+	/* zeroed and ready to be mapped to userspace */
+	drvdata->cap_ctrl = vmalloc_user(PAGE_SIZE + size);
+	if (!drvdata->cap_ctrl)
+		return -ENOMEM;
+	ret_val = devm_add_action_or_reset(dev, hellokeys_capture_free, drvdata->cap_ctrl);
+	if (ret_val)
+		return ret_val;
+	drvdata->cap_data = (u8 *)drvdata->cap_ctrl + PAGE_SIZE;
+	drvdata->cap_size = size;
+	drvdata->cap_ctrl->size = size;
+	drvdata->cap_ctrl->data_offset = PAGE_SIZE;
+
+	hrtimer_init(&drvdata->sample_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	drvdata->sample_timer.function = hellokeys_sample_timer;
+	ret_val = devm_add_action_or_reset(dev, hellokeys_cancel_sampler, drvdata);
+	if (ret_val)
+		return ret_val;
+
+	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+	if (res){
+		drvdata->rio = devm_ioremap(dev, res->start, resource_size(res));
+		if (!drvdata->rio)
+			return -ENOMEM;
+		dev_dbg(dev, "sampler on the RIO block at %pa\n", &res->start);
+	}
+
+	drvdata->descs = devm_kcalloc(dev, drvdata->num_keys, sizeof(*drvdata->descs), GFP_KERNEL);
+	drvdata->sample_values = devm_bitmap_zalloc(dev, HELLOKEYS_CAPTURE_KEYS, GFP_KERNEL);
+	if (!drvdata->descs || !drvdata->sample_values)
+		return -ENOMEM;
+	return 0;
+}
+
+static int hellokeys_setup_key(struct platform_device *pdev, struct hellokeys_key *key, struct device_node *np,
+			       u32 debounce_ms){
+	struct device *dev = &pdev->dev;
+	int ret_val;
+
+	if (of_property_read_string(np, "label", &key->label))
+		key->label = np->name;
+	of_property_read_u32(np, "debounce-interval", &debounce_ms);
+	key->debounce_us = debounce_ms * USEC_PER_MSEC;
+
+	key->code = KEY_RESERVED;
+	of_property_read_u32(np, "linux,code", &key->code);
+	if (key->code >= KEY_CNT){
+		dev_err(dev, "key %s: invalid linux,code %u\n", key->label, key->code);
+		return -EINVAL;
+	}
+	if (key->code != KEY_RESERVED)
+		input_set_capability(key->drvdata->input, EV_KEY, key->code);
+
+	key->gpiod = devm_fwnode_gpiod_get(dev, of_fwnode_handle(np), NULL, GPIOD_IN, key->label);
+	if (IS_ERR(key->gpiod))
+		return dev_err_probe(dev, PTR_ERR(key->gpiod), "key %s: could not get the gpio\n", key->label);
+	key->can_sleep = gpiod_cansleep(key->gpiod);
+
+	/* hardware debounce if the controller has it, -ENOTSUPP otherwise */
+	key->hw_debounce = key->debounce_us && !gpiod_set_debounce(key->gpiod, key->debounce_us);
+	if (key->debounce_us && !key->hw_debounce && gpiod_cansleep(key->gpiod)){
+		/* the debounce timer samples the pin from hard irq context */
+		dev_err(dev, "key %s: gpio may sleep and has no hardware debounce\n", key->label);
+		return -EINVAL;
+	}
+
+	hrtimer_init(&key->debounce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	key->debounce_timer.function = hellokeys_debounce_timer;
+	ret_val = devm_add_action_or_reset(dev, hellokeys_cancel_timer, key);
+	if (ret_val)
+		return ret_val;
+
+	key->last = gpiod_get_value_cansleep(key->gpiod);
+	if (key->last < 0)
+		return key->last;
+
+	key->irq = gpiod_to_irq(key->gpiod);
+	if (key->irq < 0)
+		return dev_err_probe(dev, key->irq, "key %s: no irq for the gpio\n", key->label);
+
+	ret_val = devm_request_threaded_irq(dev, key->irq, hellokeys_isr, hellokeys_irq_thread,
+					    IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING | IRQF_ONESHOT,
+					    key->label, key);
+	if (ret_val)
+		return dev_err_probe(dev, ret_val, "key %s: could not request irq %d\n", key->label, key->irq);
+
+	dev_dbg(dev, "key %u %s, code %u, irq %d, %s debounce %u us\n", key->index, key->label, key->code,
+		key->irq, !key->debounce_us ? "no" : key->hw_debounce ? "hardware" : "hrtimer", key->debounce_us);
+	return 0;
+}
 
 /* add probe() function */
-static int __init my_probe(struct platform_device *pdev){
+static int my_probe(struct platform_device *pdev){
+	ktime_t probe_start = ktime_get();
+	struct device *dev = &pdev->dev;
+	struct hellokeys_drvdata *drvdata;
+	u32 debounce_ms = HELLOKEYS_DEBOUNCE_MS;
+	unsigned int i;
 	int ret_val;
-	pr_info("my_probe() function is called.\n");
-	ret_val = misc_register(&helloworld_miscdevice);
 
+	dev_dbg(dev, "my_probe() function is called.\n");
+
+	drvdata = devm_kzalloc(dev, sizeof(*drvdata), GFP_KERNEL);
+	if (!drvdata)
+		return -ENOMEM;
+
+	INIT_KFIFO(drvdata->events);
+	spin_lock_init(&drvdata->events_lock);
+	mutex_init(&drvdata->read_lock);
+	mutex_init(&drvdata->debounce_lock);
+
+	/* not devm memory, open files keep it */
+	drvdata->waiters = kzalloc(sizeof(*drvdata->waiters), GFP_KERNEL);
+	if (!drvdata->waiters)
+		return -ENOMEM;
+	kref_init(&drvdata->waiters->ref);
+	init_waitqueue_head(&drvdata->waiters->wait);
+	init_waitqueue_head(&drvdata->waiters->capture_wait);
+	init_rwsem(&drvdata->waiters->lock);
+	drvdata->waiters->drvdata = drvdata;
+	ret_val = devm_add_action_or_reset(dev, hellokeys_waiters_put, drvdata->waiters);
+	if (ret_val)
+		return ret_val;
+
+	of_property_read_u32(dev->of_node, "debounce-interval", &debounce_ms);
+	drvdata->debounce_ms = debounce_ms;
+
+	drvdata->num_keys = of_get_available_child_count(dev->of_node);
+	if (!drvdata->num_keys){
+		dev_err(dev, "no keys in the device tree\n");
+		return -EINVAL;
+	}
+	drvdata->keys = devm_kcalloc(dev, drvdata->num_keys, sizeof(*drvdata->keys), GFP_KERNEL);
+	if (!drvdata->keys)
+		return -ENOMEM;
+
+	/*
+	 * allocated before the irqs so that devm unregisters it after they are freed, reporting to
+	 * it before input_register_device() below is fine, the events just reach no handler yet
+	 */
+	drvdata->input = devm_input_allocate_device(dev);
+	if (!drvdata->input)
+		return -ENOMEM;
+	drvdata->input->name = "hellokeys";
+	drvdata->input->phys = "hellokeys/input0";
+	drvdata->input->id.bustype = BUS_HOST;
+
+	ret_val = hellokeys_capture_init(pdev, drvdata);
+	if (ret_val)
+		return ret_val;
+
+	drvdata->num_keys = 0;
+	for_each_available_child_of_node_scoped(dev->of_node, child){
+		struct hellokeys_key *key = &drvdata->keys[drvdata->num_keys];
+
+		key->drvdata = drvdata;
+		key->index = drvdata->num_keys;
+		ret_val = hellokeys_setup_key(pdev, key, child, debounce_ms);
+		if (ret_val)
+			return ret_val;
+		drvdata->descs[key->index] = key->gpiod;
+		if (key->can_sleep)
+			drvdata->keys_can_sleep = true;
+		drvdata->num_keys++;
+	}
+	/* without a RIO block the sampler reads the first HELLOKEYS_CAPTURE_KEYS key lines */
+	drvdata->sample_keys = min_t(unsigned int, drvdata->num_keys, HELLOKEYS_CAPTURE_KEYS);
+
+	ret_val = input_register_device(drvdata->input);
+	if (ret_val)
+		return dev_err_probe(dev, ret_val, "could not register the input device\n");
+
+	/* the keys may have changed between reading them in setup and the input device going live */
+	spin_lock_irq(&drvdata->events_lock);
+	for (i = 0; i < drvdata->num_keys; i++){
+		if (drvdata->keys[i].code != KEY_RESERVED)
+			input_report_key(drvdata->input, drvdata->keys[i].code, drvdata->keys[i].last);
+	}
+	input_sync(drvdata->input);
+	spin_unlock_irq(&drvdata->events_lock);
+
+	drvdata->misc.minor = MISC_DYNAMIC_MINOR;
+	drvdata->misc.name = "hellokeys";
+	drvdata->misc.fops = &hellokeys_fops;
+	drvdata->misc.groups = hellokeys_groups;
+	drvdata->misc.parent = dev;
+
+	ret_val = misc_register(&drvdata->misc);
 	if (ret_val != 0){
-		pr_err("could not register the misc device mydev");
+		pr_err("could not register the misc device hellokeys");
 		return ret_val;
 	}
-	pr_info("mydev: got minor %i\n", helloworld_miscdevice.minor);
+
+	drvdata->capture_misc.minor = MISC_DYNAMIC_MINOR;
+	drvdata->capture_misc.name = "hellokeys_capture";
+	drvdata->capture_misc.fops = &hellokeys_capture_fops;
+	drvdata->capture_misc.groups = hellokeys_capture_groups;
+	drvdata->capture_misc.parent = dev;
+
+	ret_val = misc_register(&drvdata->capture_misc);
+	if (ret_val != 0){
+		pr_err("could not register the misc device hellokeys_capture");
+		misc_deregister(&drvdata->misc);
+		/* /dev/hellokeys may have been opened meanwhile */
+		hellokeys_waiters_gone(drvdata->waiters);
+		return ret_val;
+	}
+	platform_set_drvdata(pdev, drvdata);
+
+	dev_info(dev, "got minor %i, %u keys, probe took %lld us\n", drvdata->misc.minor, drvdata->num_keys,
+		 ktime_us_delta(ktime_get(), probe_start));
 	return 0;
 }
 
 /* add remove() function */
-static void __exit my_remove(struct platform_device *pdev){
-	pr_info("my_remove() function is called.\n");
-	misc_deregister(&helloworld_miscdevice);
+static void my_remove(struct platform_device *pdev){
+	struct hellokeys_drvdata *drvdata = platform_get_drvdata(pdev);
+
+	dev_dbg(&pdev->dev, "my_remove() function is called.\n");
+	misc_deregister(&drvdata->capture_misc);
+	misc_deregister(&drvdata->misc);
+	/* nothing can open a node anymore, the files still open let go of drvdata */
+	hellokeys_waiters_gone(drvdata->waiters);
 }
 
 /* declaring list of devices supported by driver */
@@ -91,6 +1121,8 @@ static struct platform_driver my_platform_driver = {
 		.name = "hellokeys",
 		.of_match_table = my_of_ids,
 		.owner = THIS_MODULE,
+		/* the keys are not needed to finish booting, probe them in parallel with other drivers */
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	}
 };
 
@@ -99,4 +1131,4 @@ module_platform_driver(my_platform_driver);
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Balavignesh");
-MODULE_DESCRIPTION("This is simplest platform driver");
+MODULE_DESCRIPTION("GPIO push button driver with debounce and timestamped events");
@@ -3,8 +3,9 @@
  *
  * In raspberry pi 5 the GPIO is handled by the RP1 chip which is connected with the memory through PCIe.
  *
- * This driver manages three LEDs connected with GPIO of pi, using the device tree. It exposes 
- * character devices (/dev/ledred, /dev/ledgreen, /dev/ledblue) for controlling each LED via 
+ * This driver manages the LEDs connected with GPIO of pi, using the device tree, one LED per
+ * child node (three on the RGB board, any number on bigger panels). It exposes character
+ * devices (/dev/ledred, /dev/ledgreen, /dev/ledblue) for controlling each LED via
  * simple write operation
  *
  * Device tree was modified using the overlays method.. compatible string: "arrow,RGBleds"
@@ -14,8 +15,20 @@
  *
  * Features:
  *  - creates a misc character device for each LED
+ *  - creates a combined /dev/rgbleds node which sets all LEDs at once from a frame
  *  - parses label and GPIO from Device tree
  *  - writes to devices turn the LEDs on/off
+ *  - a single binary write can carry a whole on/off sequence which the driver plays back
+ *  - per LED brightness through a software PWM, one hrtimer services all LEDs
+ *  - patterns uploaded once to /dev/rgbleds and looped by the driver from a timer
+ *  - a shared state page (mmap of /dev/rgbleds) for updates without any syscall
+ *  - cached gpio descriptors, optional fast mode writing the RP1 set/clear registers
+ *  - reads are served from a cached per LED state word, never from the pin
+ *  - blocking read and poll() wake up on LED state changes
+ *  - io_uring passthrough (uring_cmd) for frames, brightness and the ioctls
+ *  - per CPU call/error/byte counters and latency histograms in debugfs
+ *  - a tracepoint per operation (events/rgbleds), nothing is printed on the hot path
+ *  - every LED is also a LED class device, kernel triggers (heartbeat, netdev, timer..) drive it
  *  - memory and resource management using devm_* APIs
  *
  *  @detailed explanation: LED_README
@@ -29,57 +42,1690 @@
 #include <linux/uaccess.h>
 #include <linux/of_device.h>
 #include <linux/gpio/consumer.h>
-#include <linux/gpio.h>
-#include <linux/of_gpio.h>
+#include <linux/gpio.h> /* legacy gpio_set_value(), only kept for the latency benchmark */
+#include <linux/io.h>
+#include <linux/bitmap.h>
+#include <linux/spinlock.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/sched/signal.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
+#include <linux/rwsem.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/io_uring/cmd.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/leds.h>
 
-#define MAX_LEDS 3
+#include "rgbleds.h"
+
+#define CREATE_TRACE_POINTS
+#include "leds_trace.h"
+
+/* brightness scale, 0 is off and LED_PWM_MAX is fully on (no PWM) */
+#define LED_PWM_MAX 255
+#define LED_PWM_DEFAULT_FREQ 200
+#define LED_PWM_MAX_FREQ 10000
+/* blink_set() without delays, the same default as the timer trigger */
+#define LED_BLINK_DEFAULT_MS 500
+
+/*
+ * per LED state word served to readers without frame_lock and without reading the pin back
+ * over PCIe: brightness in the low byte, a change counter above it
+ */
+#define LED_STATE_BRIGHTNESS(state) ((state) & 0xff)
+#define LED_STATE_GEN_SHIFT 8
+
+/*
+ * RP1 RIO (registered IO) block of a GPIO bank: OUT/OE/IN registers with atomic
+ * XOR/SET/CLR aliases 0x1000/0x2000/0x3000 above them
+ */
+#define RP1_RIO_OUT 0x0
+#define RP1_RIO_IN 0x8
+#define RP1_RIO_SET 0x2000
+#define RP1_RIO_CLR 0x3000
+/*
+ * RP1 banks are GPIO 0-27, 28-33 and 34-53, each with its own RIO block. the 40 pin header is
+ * all bank 0, the only one fast mode drives (the driver's banks of 32 pins don't line up with
+ * the other two)
+ */
+#define RP1_BANK0_PINS 28
+
+/* writes the RP1 set/clear registers directly instead of going through gpiolib */
+static bool fast_mode;
+module_param(fast_mode, bool, S_IRUGO);
+MODULE_PARM_DESC(fast_mode, "drive the LEDs through the RP1 RIO set/clear registers (needs reg in DT)");
+
+/* checked on every call, so it can be flipped at runtime through /sys/module/leds_driver/parameters */
+static bool stats = true;
+module_param(stats, bool, 0644);
+MODULE_PARM_DESC(stats, "per CPU call counters and latency histograms in debugfs");
+
+/* how often the shared state page is looked at while it is mapped */
+#define LEDS_SHM_TICK_US 1000
+
+/*
+ * LEDs are grouped in banks of LEDS_BANK_WIDTH pins of one GPIO controller, all LEDs of a bank
+ * change with one register write in fast mode. out: what the pins are driven to right now
+ * (differs from the LED state only while a LED is in its PWM off phase), next: staged by
+ * led_update_locked() and written by leds_commit().
+ * bit n of the masks is pin (LEDS_BANK_WIDTH * num + n), all under drvdata->frame_lock.
+ */
+#define LEDS_BANK_WIDTH 32
+
+struct leds_bank {
+    struct device_node *chip_np; /* only compared, never dereferenced */
+    u32 num;
+    u32 active_low_mask;
+    u32 out;
+    u32 next;
+    void __iomem *rio;
+};
+
+struct leds_drvdata;
+
+/*
+ * who services the shared state page. a mapping can outlive the driver (unbind with the page still
+ * mapped), so this is not part of drvdata: every mapping and the driver hold a reference, the last
+ * one frees it. drvdata is NULL once the driver is gone, the timer is not started again then.
+ * users, drvdata and starting/stopping the timer are protected by lock
+ */
+struct leds_shm_state {
+    struct kref ref;
+    struct mutex lock;
+    unsigned int users;
+    struct hrtimer timer;
+    struct leds_drvdata *drvdata;
+};
+
+/*
+ * what blocked readers and pollers of the nodes sleep on. an open file can outlive the driver
+ * (unbind with a node open, a poll entry stays on the queue until the file is closed), so this
+ * is not part of drvdata: every open file and the driver hold a reference, the last one frees it.
+ * read and poll hold lock for reading while they look at drvdata, remove sets gone, wakes
+ * everyone (they fail with -ENODEV then) and takes lock for writing to wait for them
+ */
+struct leds_waiters {
+    struct kref ref;
+    wait_queue_head_t wait;
+    struct rw_semaphore lock;
+    bool gone;
+};
 
 struct led_dev {
     struct miscdevice led_misc_device;
+    struct leds_bank *bank;
     u32 led_mask;
     const char *led_name;
-    //struct gpio_desc *gpiod;
-    int gpio_num;
+    struct gpio_desc *gpiod;
+    int index;
+    struct leds_drvdata *drvdata;
+    bool registered;    /* the misc node exists, set by leds_nodes_work() */
+    struct led_classdev cdev;
+    bool cdev_registered;   /* also set by leds_nodes_work() */
+
+    /* written with frame_lock held, read locklessly */
+    atomic_t state;
+
+    /* software PWM, all of it is protected by drvdata->frame_lock */
+    unsigned int pwm_freq;
+    u64 pwm_period_ns;
+    u64 pwm_on_ns;
+    bool pwm_high;
+    bool blinking;  /* pwm_period_ns is the blink period set by blink_set(), not from pwm_freq */
+    ktime_t pwm_next;
+    ktime_t pwm_last_rise;
+};
+
+/*
+ * leds[], descs[] and the bitmaps are sized from the number of child nodes in the DT.
+ * frame_lock keeps the bank state in step with the pins, it is a spinlock as the gpio set
+ * calls used here never sleep and the timers take it from hard irq context. values is
+ * scratch space for the array update, also under frame_lock.
+ *
+ * a controller which may sleep (an I2C expander, gpio-sim) can't be written under frame_lock,
+ * with can_sleep leds_commit() only stages values and commit_work writes them from a worker.
+ *
+ * pwm_timer is the one hrtimer servicing every LED with a brightness between 0 and
+ * LED_PWM_MAX, it is always armed for the earliest pending edge of all of them.
+ */
+struct leds_drvdata {
+    struct led_dev **leds;
+    struct gpio_desc **descs;
+    unsigned long *values;
+    int num_leds;
+    struct leds_bank banks[RGBLEDS_MAX_BANKS];
+    int num_banks;
+    bool fast;
+    struct miscdevice frame_misc_device;
+    spinlock_t frame_lock;
+    u64 bench_ns[4];
+    bool can_sleep;
+    struct work_struct commit_work;
+    unsigned long *work_values;
+
+    /* the per LED nodes are registered from here after probe returned, dev is their parent */
+    struct work_struct nodes_work;
+    struct device *dev;
+
+    /*
+     * state change notification: gen counts changes of any LED, waiters->wait wakes blocking
+     * readers and pollers of all nodes. state_dirty is set under frame_lock by
+     * led_update_locked() and turned into a wakeup by the next leds_commit().
+     */
+    struct leds_waiters *waiters;
+    atomic_t gen;
+    bool state_dirty;
+
+    struct hrtimer pwm_timer;
+    unsigned long *pwm_active;
+    /* achieved period error, measured at every rising edge */
+    u64 pwm_jitter_max_ns;
+    u64 pwm_jitter_sum_ns;
+    u64 pwm_jitter_samples;
+
+    /*
+     * pattern engine: uploaded patterns live in a preallocated ring of slots so playback
+     * never allocates, pattern_timer steps through the keyframes of slot pattern_id
+     * (-1 when idle). protected by frame_lock like the rest of the LED state.
+     */
+    struct rgbleds_pattern patterns[LED_PATTERN_SLOTS];
+    unsigned int pattern_head;
+    int pattern_id;
+    unsigned int pattern_pos;
+    unsigned int pattern_pass;
+    struct hrtimer pattern_timer;
+
+    /*
+     * shared state page mapped by userspace, shm_state->timer applies it every tick while
+     * at least one mapping exists
+     */
+    struct rgbleds_shm *shm;
+    struct rgbleds_shm_led *shm_snapshot;
+    struct leds_shm_state *shm_state;
+    u32 shm_seq;
+
+    struct leds_pcpu_stats __percpu *stats;
+};
+
+/*
+ * per open file context of all nodes, seen is the state word (LED nodes) or gen (rgbleds)
+ * the reader got last, a read at offset 0 blocks until the current one differs from it
+ */
+struct leds_file {
+    struct miscdevice *misc;
+    struct leds_waiters *waiters;
+    unsigned int seen;
+};
+
+/*
+ * statistics, per CPU so the hot path is a few this_cpu adds without a shared cache line.
+ * hist[op][n] counts calls which spent [2^n, 2^(n+1)) ns in the driver, the last bucket all above
+ */
+enum leds_stat_op {
+    LEDS_STAT_LED_WRITE,
+    LEDS_STAT_LED_READ,
+    LEDS_STAT_FRAME_WRITE,
+    LEDS_STAT_FRAME_READ,
+    LEDS_STAT_IOCTL,        /* ioctl and uring_cmd */
+    LEDS_STAT_OPS,
+};
+
+#define LEDS_HIST_BUCKETS 32
+
+struct leds_pcpu_stats {
+    u64 calls[LEDS_STAT_OPS];
+    u64 errors[LEDS_STAT_OPS];
+    u64 bytes[LEDS_STAT_OPS];
+    u64 hist[LEDS_STAT_OPS][LEDS_HIST_BUCKETS];
+};
+
+static const char * const leds_stat_names[LEDS_STAT_OPS] = {
+    [LEDS_STAT_LED_WRITE] = "led_write",
+    [LEDS_STAT_LED_READ] = "led_read",
+    [LEDS_STAT_FRAME_WRITE] = "frame_write",
+    [LEDS_STAT_FRAME_READ] = "frame_read",
+    [LEDS_STAT_IOCTL] = "ioctl",
+};
+
+/*
+ * fast mode: the changed pins of a bank go out as one SET and one CLR write to its RIO
+ * block, next is logical so active low pins are inverted first
+ */
+static void leds_commit_rio(struct leds_bank *bank){
+    u32 changed = bank->next ^ bank->out;
+    u32 level = bank->next ^ bank->active_low_mask;
+
+    if (changed & level)
+        writel(changed & level, bank->rio + RP1_RIO_SET + RP1_RIO_OUT);
+    if (changed & ~level)
+        writel(changed & ~level, bank->rio + RP1_RIO_CLR + RP1_RIO_OUT);
+    bank->out = bank->next;
+}
+
+/*
+ * caller holds frame_lock, drives the pins to the staged next state of every bank, either
+ * with one register write pair per changed bank or with a single array update
+ */
+static int leds_commit(struct leds_drvdata *drvdata){
+    struct leds_bank *bank;
+    bool changed = false;
+    int ret_val;
+    int i;
+
+    if (drvdata->state_dirty){
+        drvdata->state_dirty = false;
+        atomic_inc(&drvdata->gen);
+        wake_up_interruptible_all(&drvdata->waiters->wait);
+    }
+
+    for (i = 0; i < drvdata->num_banks; ++i){
+        bank = &drvdata->banks[i];
+        if (bank->next == bank->out)
+            continue;
+        changed = true;
+        if (drvdata->fast)
+            leds_commit_rio(bank);
+    }
+    if (!changed || drvdata->fast)
+        return 0;
+
+    bitmap_zero(drvdata->values, drvdata->num_leds);
+    for (i = 0; i < drvdata->num_leds; ++i){
+        if (drvdata->leds[i]->bank->next & drvdata->leds[i]->led_mask)
+            __set_bit(i, drvdata->values);
+    }
+
+    if (drvdata->can_sleep){
+        for (i = 0; i < drvdata->num_banks; ++i)
+            drvdata->banks[i].out = drvdata->banks[i].next;
+        queue_work(system_highpri_wq, &drvdata->commit_work);
+        return 0;
+    }
+
+    ret_val = gpiod_set_array_value(drvdata->num_leds, drvdata->descs, NULL, drvdata->values);
+    for (i = 0; i < drvdata->num_banks; ++i){
+        bank = &drvdata->banks[i];
+        if (ret_val)
+            bank->next = bank->out;
+        else
+            bank->out = bank->next;
+    }
+    return ret_val;
+}
+
+/*
+ * writes the values of the last commit to a controller which may sleep. changes committed while
+ * it runs queue it again, a burst of them ends up as one update with the latest values
+ */
+static void leds_commit_work(struct work_struct *work){
+    struct leds_drvdata *drvdata = container_of(work, struct leds_drvdata, commit_work);
+    unsigned long flags;
+    int ret_val;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    bitmap_copy(drvdata->work_values, drvdata->values, drvdata->num_leds);
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    ret_val = gpiod_set_array_value_cansleep(drvdata->num_leds, drvdata->descs, NULL, drvdata->work_values);
+    if (ret_val)
+        pr_err_ratelimited("leds: setting the pins failed: %d\n", ret_val);
+}
+
+/* caller holds frame_lock, makes sure the timer fires no later than expires */
+static void leds_pwm_kick(struct leds_drvdata *drvdata, ktime_t expires){
+    struct hrtimer *timer = &drvdata->pwm_timer;
+
+    if (!hrtimer_active(timer) || ktime_before(expires, hrtimer_get_expires(timer)))
+        hrtimer_start(timer, expires, HRTIMER_MODE_ABS);
+}
+
+static unsigned int led_brightness(struct led_dev *led_device){
+    return LED_STATE_BRIGHTNESS((unsigned int)atomic_read_acquire(&led_device->state));
+}
+
+/*
+ * caller holds frame_lock, sets the LED state and stages its pin in bank->next, the pins are
+ * written by the caller with leds_commit() so that several LEDs can change with one commit.
+ * writers are already serialized by frame_lock, so publishing the state word is a plain
+ * release store, readers pair it with atomic_read_acquire()
+ */
+static void led_update_locked(struct led_dev *led_device, unsigned int brightness){
+    struct leds_drvdata *drvdata = led_device->drvdata;
+    struct leds_bank *bank = led_device->bank;
+    u32 mask = led_device->led_mask;
+    unsigned int state;
+    ktime_t now;
+
+    /* any other update ends a hardware blink, the PWM goes back to pwm_freq */
+    if (led_device->blinking){
+        led_device->blinking = false;
+        led_device->pwm_period_ns = NSEC_PER_SEC / led_device->pwm_freq;
+        led_device->pwm_last_rise = 0;
+    }
+
+    brightness = min_t(unsigned int, brightness, LED_PWM_MAX);
+    state = atomic_read(&led_device->state);
+    if (LED_STATE_BRIGHTNESS(state) != brightness){
+        atomic_set_release(&led_device->state, (((state >> LED_STATE_GEN_SHIFT) + 1) << LED_STATE_GEN_SHIFT) | brightness);
+        drvdata->state_dirty = true;
+    }
+
+    if (brightness == 0 || brightness == LED_PWM_MAX){
+        __clear_bit(led_device->index, drvdata->pwm_active);
+        if (brightness)
+            bank->next |= mask;
+        else
+            bank->next &= ~mask;
+        return;
+    }
+
+    led_device->pwm_on_ns = div_u64(led_device->pwm_period_ns * brightness, LED_PWM_MAX);
+
+    /* a running LED picks up the new duty cycle at its next edge */
+    if (__test_and_set_bit(led_device->index, drvdata->pwm_active))
+        return;
+
+    now = ktime_get();
+    led_device->pwm_high = true;
+    led_device->pwm_last_rise = 0;
+    led_device->pwm_next = ktime_add_ns(now, led_device->pwm_on_ns);
+    bank->next |= mask;
+    leds_pwm_kick(drvdata, led_device->pwm_next);
+}
+
+static int led_write_brightness(struct led_dev *led_device, unsigned int brightness){
+    struct leds_drvdata *drvdata = led_device->drvdata;
+    unsigned long flags;
+    int ret_val;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    led_update_locked(led_device, brightness);
+    ret_val = leds_commit(drvdata);
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    return ret_val;
+}
+
+static int led_set(struct led_dev *led_device, int value){
+    return led_write_brightness(led_device, value ? LED_PWM_MAX : 0);
+}
+
+/*
+ * LED class hooks, the triggers call them from any context (timer and irq too), both only
+ * take frame_lock and never sleep. the class device uses the same 0..LED_PWM_MAX scale
+ */
+static void led_cdev_brightness_set(struct led_classdev *cdev, enum led_brightness brightness){
+    led_write_brightness(container_of(cdev, struct led_dev, cdev), brightness);
+}
+
+/* the brightness may have been changed through the misc nodes, the class reads it from here */
+static enum led_brightness led_cdev_brightness_get(struct led_classdev *cdev){
+    return led_brightness(container_of(cdev, struct led_dev, cdev));
+}
+
+/*
+ * blinking (timer, netdev, disk activity, pattern triggers) runs on the software PWM: a blink
+ * is a PWM cycle of delay_on + delay_off, so the LED toggles from the PWM timer without the
+ * LED core running a timer per LED. the state word shows the duty cycle as brightness.
+ * periods below what the PWM does are refused, the core then blinks in software
+ */
+static int led_cdev_blink_set(struct led_classdev *cdev, unsigned long *delay_on, unsigned long *delay_off){
+    struct led_dev *led_device = container_of(cdev, struct led_dev, cdev);
+    struct leds_drvdata *drvdata = led_device->drvdata;
+    unsigned int brightness;
+    unsigned long flags;
+    u64 on_ns, period_ns;
+    int ret_val;
+
+    if (!*delay_on && !*delay_off){
+        *delay_on = LED_BLINK_DEFAULT_MS;
+        *delay_off = LED_BLINK_DEFAULT_MS;
+    }
+    on_ns = (u64)*delay_on * NSEC_PER_MSEC;
+    period_ns = on_ns + (u64)*delay_off * NSEC_PER_MSEC;
+    if (period_ns < NSEC_PER_SEC / LED_PWM_MAX_FREQ)
+        return -EINVAL;
+
+    /* steady on or off when one of the delays is 0, otherwise never rounded to either */
+    if (!*delay_off)
+        brightness = LED_PWM_MAX;
+    else if (!*delay_on)
+        brightness = 0;
+    else
+        brightness = clamp_t(unsigned int, div64_u64(on_ns * LED_PWM_MAX + period_ns / 2, period_ns),
+                             1, LED_PWM_MAX - 1);
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    led_update_locked(led_device, brightness);
+    if (test_bit(led_device->index, drvdata->pwm_active)){
+        /* the blink starts with its on phase from now */
+        led_device->blinking = true;
+        led_device->pwm_period_ns = period_ns;
+        led_device->pwm_on_ns = on_ns;
+        led_device->pwm_high = true;
+        led_device->pwm_last_rise = 0;
+        led_device->pwm_next = ktime_add_ns(ktime_get(), on_ns);
+        led_device->bank->next |= led_device->led_mask;
+        leds_pwm_kick(drvdata, led_device->pwm_next);
+    }
+    ret_val = leds_commit(drvdata);
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    return ret_val;
+}
+
+static void leds_pwm_account(struct leds_drvdata *drvdata, struct led_dev *led_device, ktime_t now){
+    u64 period, error;
+
+    if (led_device->pwm_last_rise){
+        period = ktime_to_ns(ktime_sub(now, led_device->pwm_last_rise));
+        error = period > led_device->pwm_period_ns ? period - led_device->pwm_period_ns :
+                                                     led_device->pwm_period_ns - period;
+        drvdata->pwm_jitter_max_ns = max(drvdata->pwm_jitter_max_ns, error);
+        drvdata->pwm_jitter_sum_ns += error;
+        drvdata->pwm_jitter_samples++;
+    }
+    led_device->pwm_last_rise = now;
+}
+
+/*
+ * services every PWM LED from one timer: toggles all LEDs whose edge is due, writes the
+ * pins once and re-arms for the earliest next edge
+ */
+static enum hrtimer_restart leds_pwm_timer(struct hrtimer *timer){
+    struct leds_drvdata *drvdata = container_of(timer, struct leds_drvdata, pwm_timer);
+    struct led_dev *led_device;
+    enum hrtimer_restart restart;
+    ktime_t next = KTIME_MAX;
+    unsigned long flags;
+    ktime_t now;
+    int i;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    now = ktime_get();
+
+    for_each_set_bit(i, drvdata->pwm_active, drvdata->num_leds){
+        led_device = drvdata->leds[i];
+
+        if (!ktime_after(led_device->pwm_next, now)){
+            led_device->pwm_high = !led_device->pwm_high;
+            if (led_device->pwm_high){
+                led_device->bank->next |= led_device->led_mask;
+                leds_pwm_account(drvdata, led_device, now);
+                led_device->pwm_next = ktime_add_ns(led_device->pwm_next, led_device->pwm_on_ns);
+            } else {
+                led_device->bank->next &= ~led_device->led_mask;
+                led_device->pwm_next = ktime_add_ns(led_device->pwm_next,
+                                                    led_device->pwm_period_ns - led_device->pwm_on_ns);
+            }
+            /* we were late by more than a whole phase, restart the phase from now */
+            if (!ktime_after(led_device->pwm_next, now))
+                led_device->pwm_next = ktime_add_ns(now, led_device->pwm_high ? led_device->pwm_on_ns :
+                                                    led_device->pwm_period_ns - led_device->pwm_on_ns);
+        }
+
+        if (ktime_before(led_device->pwm_next, next))
+            next = led_device->pwm_next;
+    }
+
+    leds_commit(drvdata);
+
+    /*
+     * leds_pwm_kick() may have re-armed the timer while we waited for the lock, the expiry
+     * of a queued timer must not be touched, so only pull it earlier if needed
+     */
+    if (hrtimer_is_queued(timer)){
+        if (next != KTIME_MAX)
+            leds_pwm_kick(drvdata, next);
+        restart = HRTIMER_NORESTART;
+    } else {
+        /* KTIME_MAX tells leds_pwm_kick() that the timer is about to stop */
+        hrtimer_set_expires(timer, next);
+        restart = next == KTIME_MAX ? HRTIMER_NORESTART : HRTIMER_RESTART;
+    }
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    return restart;
+}
+
+/* caller holds frame_lock, shows the current keyframe and returns how long to hold it */
+static unsigned int leds_pattern_apply_locked(struct leds_drvdata *drvdata){
+    const struct rgbleds_keyframe *keyframe = &drvdata->patterns[drvdata->pattern_id].frames[drvdata->pattern_pos];
+    unsigned int brightness = keyframe->brightness ? keyframe->brightness : LED_PWM_MAX;
+    struct led_dev *led_device;
+    unsigned int bank;
+    bool on;
+    int i;
+
+    for (i = 0; i < drvdata->num_leds; ++i){
+        led_device = drvdata->leds[i];
+        bank = led_device->bank - drvdata->banks;
+        on = bank < LED_PATTERN_BANKS && (keyframe->frame[bank] & led_device->led_mask);
+        led_update_locked(led_device, on ? brightness : 0);
+    }
+    leds_commit(drvdata);
+
+    return keyframe->hold_ms;
+}
+
+static enum hrtimer_restart leds_pattern_timer(struct hrtimer *timer){
+    struct leds_drvdata *drvdata = container_of(timer, struct leds_drvdata, pattern_timer);
+    const struct rgbleds_pattern *pattern;
+    enum hrtimer_restart restart = HRTIMER_NORESTART;
+    unsigned long flags;
+    unsigned int hold_ms;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+
+    /* stopped, or restarted by leds_pattern_play() while we waited for the lock */
+    if (drvdata->pattern_id < 0 || hrtimer_is_queued(timer))
+        goto out;
+
+    pattern = &drvdata->patterns[drvdata->pattern_id];
+    if (++drvdata->pattern_pos == pattern->count){
+        drvdata->pattern_pos = 0;
+        if (pattern->repeat && ++drvdata->pattern_pass == pattern->repeat){
+            /* the LEDs keep the last keyframe */
+            drvdata->pattern_id = -1;
+            goto out;
+        }
+    }
+
+    hold_ms = leds_pattern_apply_locked(drvdata);
+    hrtimer_forward_now(timer, ms_to_ktime(hold_ms));
+    restart = HRTIMER_RESTART;
+out:
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+    return restart;
+}
+
+static int leds_pattern_play(struct leds_drvdata *drvdata, u32 id){
+    unsigned long flags;
+    unsigned int hold_ms;
+
+    if (id >= LED_PATTERN_SLOTS)
+        return -EINVAL;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    if (!drvdata->patterns[id].count){
+        spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+        return -ENOENT;
+    }
+    drvdata->pattern_id = id;
+    drvdata->pattern_pos = 0;
+    drvdata->pattern_pass = 0;
+    hold_ms = leds_pattern_apply_locked(drvdata);
+    hrtimer_start(&drvdata->pattern_timer, ms_to_ktime(hold_ms), HRTIMER_MODE_REL);
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    return 0;
+}
+
+/* the timer notices pattern_id == -1 and does not restart, so no cancel is needed here */
+static void leds_pattern_stop(struct leds_drvdata *drvdata){
+    unsigned long flags;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    drvdata->pattern_id = -1;
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+}
+
+/* caller holds frame_lock */
+static int leds_pattern_find_locked(struct leds_drvdata *drvdata, const char *name){
+    int id;
+
+    for (id = 0; id < LED_PATTERN_SLOTS; ++id){
+        if (drvdata->patterns[id].count && !strcmp(drvdata->patterns[id].name, name))
+            return id;
+    }
+    return -ENOENT;
+}
+
+static long leds_pattern_upload(struct leds_drvdata *drvdata, const void __user *argp){
+    struct rgbleds_pattern *pattern;
+    unsigned long flags;
+    long id;
+    u32 i;
+
+    pattern = memdup_user(argp, sizeof(*pattern));
+    if (IS_ERR(pattern))
+        return PTR_ERR(pattern);
+
+    pattern->name[LED_PATTERN_NAME_LEN - 1] = '\0';
+    if (!pattern->name[0] || !pattern->count || pattern->count > LED_PATTERN_MAX_FRAMES){
+        kfree(pattern);
+        return -EINVAL;
+    }
+    for (i = 0; i < pattern->count; ++i){
+        if (!pattern->frames[i].hold_ms){
+            kfree(pattern);
+            return -EINVAL;
+        }
+    }
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    id = leds_pattern_find_locked(drvdata, pattern->name);
+    if (id < 0){
+        id = drvdata->pattern_head;
+        drvdata->pattern_head = (drvdata->pattern_head + 1) % LED_PATTERN_SLOTS;
+    }
+    /* the slot is overwritten, stop it if it is the one playing */
+    if (drvdata->pattern_id == id)
+        drvdata->pattern_id = -1;
+    drvdata->patterns[id] = *pattern;
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    kfree(pattern);
+    return id;
+}
+
+static ssize_t brightness_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct led_dev *led_device = container_of(misc, struct led_dev, led_misc_device);
+
+    return sysfs_emit(buf, "%u\n", led_brightness(led_device));
+}
+
+static ssize_t brightness_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct led_dev *led_device = container_of(misc, struct led_dev, led_misc_device);
+    unsigned int brightness;
+    int ret_val;
+
+    ret_val = kstrtouint(buf, 0, &brightness);
+    if (ret_val)
+        return ret_val;
+    if (brightness > LED_PWM_MAX)
+        return -EINVAL;
+
+    ret_val = led_write_brightness(led_device, brightness);
+    return ret_val ? ret_val : count;
+}
+static DEVICE_ATTR_RW(brightness);
+
+static ssize_t pwm_freq_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct led_dev *led_device = container_of(misc, struct led_dev, led_misc_device);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(led_device->pwm_freq));
+}
+
+static ssize_t pwm_freq_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct led_dev *led_device = container_of(misc, struct led_dev, led_misc_device);
+    struct leds_drvdata *drvdata = led_device->drvdata;
+    unsigned long flags;
+    unsigned int freq;
+    int ret_val;
+
+    ret_val = kstrtouint(buf, 0, &freq);
+    if (ret_val)
+        return ret_val;
+    if (!freq || freq > LED_PWM_MAX_FREQ)
+        return -EINVAL;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    led_device->pwm_freq = freq;
+    led_device->blinking = false;
+    led_device->pwm_period_ns = NSEC_PER_SEC / freq;
+    led_device->pwm_on_ns = div_u64(led_device->pwm_period_ns * led_brightness(led_device), LED_PWM_MAX);
+    led_device->pwm_last_rise = 0;
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    return count;
+}
+static DEVICE_ATTR_RW(pwm_freq);
+
+static struct attribute *led_attrs[] = {
+    &dev_attr_brightness.attr,
+    &dev_attr_pwm_freq.attr,
+    NULL,
 };
+ATTRIBUTE_GROUPS(led);
+
+/* ret is what the fop returns, -EAGAIN of O_NONBLOCK readers is no error. returns the time in ns */
+static u64 leds_stats_account(struct leds_drvdata *drvdata, enum leds_stat_op op, ktime_t start, long ret){
+    u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    unsigned int bucket = ns ? min_t(unsigned int, ilog2(ns), LEDS_HIST_BUCKETS - 1) : 0;
+
+    /* the tracepoints still get the time */
+    if (!READ_ONCE(stats))
+        return ns;
+    this_cpu_inc(drvdata->stats->calls[op]);
+    this_cpu_inc(drvdata->stats->hist[op][bucket]);
+    if (ret < 0){
+        if (ret != -EAGAIN)
+            this_cpu_inc(drvdata->stats->errors[op]);
+    } else if (op != LEDS_STAT_IOCTL){
+        this_cpu_add(drvdata->stats->bytes[op], ret);
+    }
+    return ns;
+}
+
+/* bank 0 of the current frame for the tracepoints, only built while they are enabled */
+static u32 leds_frame_bank0(struct leds_drvdata *drvdata){
+    u32 frame = 0;
+    int i;
+
+    for (i = 0; i < drvdata->num_leds; ++i){
+        if (drvdata->leds[i]->bank == drvdata->banks && led_brightness(drvdata->leds[i]))
+            frame |= drvdata->leds[i]->led_mask;
+    }
+    return frame;
+}
+
+static struct led_dev *led_from_file(struct file *file){
+    struct leds_file *ctx = file->private_data;
+
+    return container_of(ctx->misc, struct led_dev, led_misc_device);
+}
+
+static struct leds_drvdata *drvdata_from_file(struct file *file){
+    struct leds_file *ctx = file->private_data;
+
+    return container_of(ctx->misc, struct leds_drvdata, frame_misc_device);
+}
+
+static void leds_waiters_release(struct kref *ref){
+    kfree(container_of(ref, struct leds_waiters, ref));
+}
+
+/* devm action, the driver's reference. runs after remove, the timers can't wake the queue anymore */
+static void leds_waiters_put(void *data){
+    struct leds_waiters *waiters = data;
+
+    kref_put(&waiters->ref, leds_waiters_release);
+}
+
+/*
+ * called from remove once no node is left to open. readers and pollers still inside are woken
+ * and finish before drvdata goes away, the ones coming later see gone and never touch it
+ */
+static void leds_waiters_gone(struct leds_waiters *waiters){
+    WRITE_ONCE(waiters->gone, true);
+    wake_up_interruptible_all(&waiters->wait);
+    down_write(&waiters->lock);
+    up_write(&waiters->lock);
+}
+
+/* false when the driver is gone, otherwise drvdata stays until leds_leave() */
+static bool leds_enter(struct leds_file *ctx){
+    down_read(&ctx->waiters->lock);
+    if (!READ_ONCE(ctx->waiters->gone))
+        return true;
+    up_read(&ctx->waiters->lock);
+    return false;
+}
+
+static void leds_leave(struct leds_file *ctx){
+    up_read(&ctx->waiters->lock);
+}
+
+/*
+ * misc_open() put the miscdevice in private_data, it moves into the per file context. open runs
+ * under misc_mtx, so the node can't be deregistered meanwhile and drvdata is still there
+ */
+static int leds_open(struct inode *inode, struct file *file, struct leds_waiters *waiters){
+    struct leds_file *ctx;
+
+    ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+    if (!ctx)
+        return -ENOMEM;
+
+    ctx->misc = file->private_data;
+    ctx->waiters = waiters;
+    kref_get(&waiters->ref);
+    file->private_data = ctx;
+    return 0;
+}
+
+static int leds_release(struct inode *inode, struct file *file){
+    struct leds_file *ctx = file->private_data;
+
+    kref_put(&ctx->waiters->ref, leds_waiters_release);
+    kfree(ctx);
+    return 0;
+}
+
+static unsigned int led_state(struct led_dev *led_device){
+    return atomic_read_acquire(&led_device->state);
+}
+
+/*
+ * waits until the state differs from what this file saw last, the first read of a file
+ * always returns right away as seen starts out as the complement of the state. the caller
+ * is inside leds_enter(), -ENODEV when the driver goes away meanwhile
+ */
+static int leds_wait_change(struct file *file, unsigned int (*current_state)(void *), void *arg, unsigned int *state){
+    struct leds_file *ctx = file->private_data;
+    struct leds_waiters *waiters = ctx->waiters;
+    int ret_val;
+
+    *state = current_state(arg);
+    if (*state != ctx->seen)
+        return 0;
+    if (file->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+
+    ret_val = wait_event_interruptible(waiters->wait,
+                                       READ_ONCE(waiters->gone) || (*state = current_state(arg)) != ctx->seen);
+    if (!ret_val && READ_ONCE(waiters->gone))
+        return -ENODEV;
+    return ret_val;
+}
+
+static unsigned int led_state_cb(void *arg){
+    return led_state(arg);
+}
+
+static unsigned int leds_gen_cb(void *arg){
+    struct leds_drvdata *drvdata = arg;
+
+    return atomic_read_acquire(&drvdata->gen);
+}
+
+/*
+ * plays a batched sequence (see rgbleds.h) from the kernel, the caller sleeps between the
+ * entries instead of spinning in userspace with one write per edge. stops at the first entry
+ * which can't be set and returns its error, the LED keeps the last state set
+ */
+static ssize_t led_write_seq(struct led_dev *led_device, const char __user *buff, size_t count){
+    struct led_seq_header hdr;
+    struct led_seq_entry *entries;
+    ssize_t ret_val;
+    u32 i;
+
+    if (copy_from_user(&hdr, buff, sizeof(hdr)))
+        return -EFAULT;
+
+    if (!hdr.count || hdr.count > LED_SEQ_MAX_ENTRIES)
+        return -EINVAL;
+    if (count != sizeof(hdr) + (size_t)hdr.count * sizeof(*entries))
+        return -EINVAL;
+
+    entries = memdup_user(buff + sizeof(hdr), hdr.count * sizeof(*entries));
+    if (IS_ERR(entries))
+        return PTR_ERR(entries);
+
+    for (i = 0; i < hdr.count; ++i){
+        ret_val = led_set(led_device, entries[i].state != 0);
+        if (ret_val)
+            break;
+
+        /* long holds sleep interruptibly, so a killed writer does not wait out the sequence */
+        if (entries[i].delay_us >= 20 * USEC_PER_MSEC)
+            msleep_interruptible(entries[i].delay_us / USEC_PER_MSEC);
+        else if (entries[i].delay_us)
+            fsleep(entries[i].delay_us);
+
+        if (signal_pending(current)){
+            ret_val = -EINTR;
+            break;
+        }
+    }
+
+    kfree(entries);
+    return ret_val ? ret_val : count;
+}
+
+static ssize_t led_do_write(struct file *file, const char __user *buff, size_t count, loff_t *ppos){
+    struct led_dev *led_device = led_from_file(file);
+    u32 magic;
+    int ret_val;
+
+    if (count >= sizeof(struct led_seq_header)){
+        if (get_user(magic, (const u32 __user *)buff))
+            return -EFAULT;
+        if (magic == LED_SEQ_MAGIC)
+            return led_write_seq(led_device, buff, count);
+    }
+
+    char kbuf[2];
+    if (copy_from_user(kbuf, buff, 1))
+        return -EFAULT;
+
+    kbuf[1] = '\0';
+
+    if (kbuf[0] != '1' && kbuf[0] != '0')
+        return -EINVAL;
+
+    ret_val = led_set(led_device, kbuf[0] == '1');
+    return ret_val ? ret_val : count;
+}
+
+static ssize_t led_write(struct file *file, const char __user *buff, size_t count, loff_t *ppos){
+    struct led_dev *led_device = led_from_file(file);
+    ktime_t start = ktime_get();
+    ssize_t ret_val;
+    u64 ns;
+
+    ret_val = led_do_write(file, buff, count, ppos);
+    ns = leds_stats_account(led_device->drvdata, LEDS_STAT_LED_WRITE, start, ret_val);
+    if (trace_rgbleds_led_write_enabled())
+        trace_rgbleds_led_write(led_device->led_name, led_brightness(led_device), ret_val, ns);
+    return ret_val;
+}
+
+/*
+ * served from the cached state, a read never goes out to the pin. the node reads like a file
+ * with one "0\n"/"1\n" record: a read at offset 0 which would return the state already seen
+ * blocks until it changes (or fails with -EAGAIN for O_NONBLOCK), reads further on return the
+ * rest of that record and then EOF, so cat prints the state once and exits
+ */
+static ssize_t led_do_read(struct file *file, char __user *buff, size_t count, loff_t *ppos){
+    struct leds_file *ctx = file->private_data;
+    struct led_dev *led_device = led_from_file(file);
+    unsigned int state;
+    char record[2];
+    int ret_val;
+
+    if (*ppos >= sizeof(record))
+        return 0;
+    if (!*ppos){
+        ret_val = leds_wait_change(file, led_state_cb, led_device, &state);
+        if (ret_val)
+            return ret_val;
+        ctx->seen = state;
+    }
+
+    /* the record of a fresh read, or the rest of the one read at offset 0 */
+    record[0] = LED_STATE_BRIGHTNESS(ctx->seen) ? '1' : '0';
+    record[1] = '\n';
+    count = min_t(size_t, count, sizeof(record) - *ppos);
+    if (copy_to_user(buff, record + *ppos, count))
+        return -EFAULT;
+    *ppos += count;
+    return count;
+}
+
+static ssize_t led_read(struct file *file, char __user *buff, size_t count, loff_t *ppos){
+    struct leds_file *ctx = file->private_data;
+    struct led_dev *led_device = led_from_file(file);
+    ktime_t start = ktime_get();
+    ssize_t ret_val;
+    u64 ns;
+
+    if (!leds_enter(ctx))
+        return -ENODEV;
+    ret_val = led_do_read(file, buff, count, ppos);
+    ns = leds_stats_account(led_device->drvdata, LEDS_STAT_LED_READ, start, ret_val);
+    if (trace_rgbleds_led_read_enabled())
+        trace_rgbleds_led_read(led_device->led_name, led_brightness(led_device), ret_val, ns);
+    leds_leave(ctx);
+    return ret_val;
+}
+
+static __poll_t led_poll(struct file *file, poll_table *wait){
+    struct leds_file *ctx = file->private_data;
+    struct led_dev *led_device = led_from_file(file);
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(file, &ctx->waiters->wait, wait);
+    if (!leds_enter(ctx))
+        return EPOLLERR | EPOLLHUP;
+    if (led_state(led_device) != ctx->seen)
+        mask |= EPOLLIN | EPOLLRDNORM;
+    leds_leave(ctx);
+    return mask;
+}
+
+static int led_open(struct inode *inode, struct file *file){
+    struct led_dev *led_device;
+    struct leds_file *ctx;
+    int ret_val;
+
+    led_device = container_of(file->private_data, struct led_dev, led_misc_device);
+    ret_val = leds_open(inode, file, led_device->drvdata->waiters);
+    if (ret_val)
+        return ret_val;
+
+    ctx = file->private_data;
+    ctx->seen = ~led_state(led_device);
+    return 0;
+}
 
-struct leds_drvdata {
-    struct led_dev *leds[MAX_LEDS];
-    int num_leds;
+/*
+ * io_uring passthrough (see rgbleds.h), the brightness comes inline in the sqe. the write only
+ * takes frame_lock (a sleeping controller is written by commit_work), so the command completes
+ * right in the submitting task, no punt to an io-wq worker
+ */
+static int led_do_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags){
+    const struct rgbleds_uring_cmd *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+    u32 brightness;
+
+    if (ioucmd->cmd_op != RGBLEDS_UCMD_BRIGHTNESS)
+        return -ENOTTY;
+
+    brightness = READ_ONCE(cmd->brightness);
+    if (brightness > LED_PWM_MAX)
+        return -EINVAL;
+    return led_write_brightness(led_from_file(ioucmd->file), brightness);
+}
+
+static int led_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags){
+    struct led_dev *led_device = led_from_file(ioucmd->file);
+    ktime_t start = ktime_get();
+    int ret_val;
+    u64 ns;
+
+    ret_val = led_do_uring_cmd(ioucmd, issue_flags);
+    /* the punt of a nonblocking issue is not a call, io-wq issues the command again */
+    if (ret_val == -EAGAIN && (issue_flags & IO_URING_F_NONBLOCK))
+        return ret_val;
+    ns = leds_stats_account(led_device->drvdata, LEDS_STAT_IOCTL, start, ret_val);
+    if (trace_rgbleds_ioctl_enabled())
+        trace_rgbleds_ioctl(led_device->led_name, led_brightness(led_device), ret_val, ns);
+    return ret_val;
+}
+
+static const struct file_operations led_fops = {
+    .owner = THIS_MODULE,
+    .open = led_open,
+    .release = leds_release,
+    .write = led_write,
+    .read = led_read,
+    .llseek = default_llseek,
+    .poll = led_poll,
+    .uring_cmd = led_uring_cmd,
 };
 
-static ssize_t led_write(struct file *file, const char __user *buff, size_t count, loff_t *ppos){
-    struct led_dev *led_device = container_of(file->private_data, struct led_dev, led_misc_device);
-    pr_info("LED device: %s write called\n", led_device->led_name);
+/*
+ * /dev/rgbleds takes a whole frame (one u32 per bank, see rgbleds.h) and drives every LED
+ * with a single commit, so a color change is one syscall and all channels switch together
+ * instead of one by one.
+ */
+static int leds_set_frame(struct leds_drvdata *drvdata, const u32 *frame){
+    struct led_dev *led_device;
+    unsigned long flags;
+    int ret_val;
+    int i;
 
-    char kbuf[2];
-    if (copy_from_user(kbuf, buff, 1))
-        return -EFAULT;
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    /* an explicit frame takes over from a running pattern */
+    drvdata->pattern_id = -1;
+    for (i = 0; i < drvdata->num_leds; ++i){
+        led_device = drvdata->leds[i];
+        led_update_locked(led_device, (frame[led_device->bank - drvdata->banks] & led_device->led_mask) ? LED_PWM_MAX : 0);
+    }
+    ret_val = leds_commit(drvdata);
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
 
-    kbuf[1] = '\0';
+    return ret_val;
+}
 
-    if (kbuf[0] == '1')
-        gpio_set_value(led_device->gpio_num, 1);
-    else if (kbuf[0] == '0')
-        gpio_set_value(led_device->gpio_num, 0);
-    else
+static ssize_t frame_do_write(struct file *file, const char __user *buff, size_t count, loff_t *ppos){
+    struct leds_drvdata *drvdata = drvdata_from_file(file);
+    u32 frame[RGBLEDS_MAX_BANKS];
+    int ret_val;
+
+    if (count != drvdata->num_banks * sizeof(u32))
         return -EINVAL;
 
+    if (copy_from_user(frame, buff, count))
+        return -EFAULT;
+
+    ret_val = leds_set_frame(drvdata, frame);
+    return ret_val ? ret_val : count;
+}
+
+static ssize_t frame_write(struct file *file, const char __user *buff, size_t count, loff_t *ppos){
+    struct leds_drvdata *drvdata = drvdata_from_file(file);
+    ktime_t start = ktime_get();
+    ssize_t ret_val;
+    u64 ns;
+
+    ret_val = frame_do_write(file, buff, count, ppos);
+    ns = leds_stats_account(drvdata, LEDS_STAT_FRAME_WRITE, start, ret_val);
+    if (trace_rgbleds_frame_write_enabled())
+        trace_rgbleds_frame_write(drvdata->frame_misc_device.name, leds_frame_bank0(drvdata), ret_val, ns);
+    return ret_val;
+}
+
+/*
+ * built from the per LED state words, so readers never wait for writers or the PWM timer.
+ * like the LED nodes a read at offset 0 returns one whole frame and blocks until something
+ * changed since the last frame this file got, a read further on is EOF
+ */
+static ssize_t frame_do_read(struct file *file, char __user *buff, size_t count, loff_t *ppos){
+    struct leds_file *ctx = file->private_data;
+    struct leds_drvdata *drvdata = drvdata_from_file(file);
+    struct led_dev *led_device;
+    u32 frame[RGBLEDS_MAX_BANKS] = {};
+    unsigned int gen;
+    int ret_val;
+    int i;
+
+    if (*ppos)
+        return 0;
+    ret_val = leds_wait_change(file, leds_gen_cb, drvdata, &gen);
+    if (ret_val)
+        return ret_val;
+    ctx->seen = gen;
+
+    for (i = 0; i < drvdata->num_leds; ++i){
+        led_device = drvdata->leds[i];
+        if (led_brightness(led_device))
+            frame[led_device->bank - drvdata->banks] |= led_device->led_mask;
+    }
+
+    count = min(count, drvdata->num_banks * sizeof(u32));
+    if (copy_to_user(buff, frame, count))
+        return -EFAULT;
+    *ppos += count;
     return count;
 }
 
-static ssize_t led_read(struct file *file, char __user *buff, size_t count, loff_t *ppos){
-    struct led_dev *led_device = container_of(file->private_data, struct led_dev, led_misc_device);
-    int value = gpio_get_value(led_device->gpio_num);
-    char state[2] = {value ? '1': '0', '\n' };
+static ssize_t frame_read(struct file *file, char __user *buff, size_t count, loff_t *ppos){
+    struct leds_file *ctx = file->private_data;
+    struct leds_drvdata *drvdata = drvdata_from_file(file);
+    ktime_t start = ktime_get();
+    ssize_t ret_val;
+    u64 ns;
 
-    return simple_read_from_buffer(buff, count, ppos, state, sizeof(state));
+    if (!leds_enter(ctx))
+        return -ENODEV;
+    ret_val = frame_do_read(file, buff, count, ppos);
+    ns = leds_stats_account(drvdata, LEDS_STAT_FRAME_READ, start, ret_val);
+    if (trace_rgbleds_frame_read_enabled())
+        trace_rgbleds_frame_read(drvdata->frame_misc_device.name, leds_frame_bank0(drvdata), ret_val, ns);
+    leds_leave(ctx);
+    return ret_val;
 }
 
-static const struct file_operations led_fops = {
+static __poll_t frame_poll(struct file *file, poll_table *wait){
+    struct leds_file *ctx = file->private_data;
+    struct leds_drvdata *drvdata = drvdata_from_file(file);
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(file, &ctx->waiters->wait, wait);
+    if (!leds_enter(ctx))
+        return EPOLLERR | EPOLLHUP;
+    if (atomic_read_acquire(&drvdata->gen) != ctx->seen)
+        mask |= EPOLLIN | EPOLLRDNORM;
+    leds_leave(ctx);
+    return mask;
+}
+
+static int frame_open(struct inode *inode, struct file *file){
+    struct leds_drvdata *drvdata = container_of(file->private_data, struct leds_drvdata, frame_misc_device);
+    struct leds_file *ctx;
+    int ret_val;
+
+    ret_val = leds_open(inode, file, drvdata->waiters);
+    if (ret_val)
+        return ret_val;
+
+    ctx = file->private_data;
+    ctx->seen = ~atomic_read(&drvdata->gen);
+    return 0;
+}
+
+/* the LED state is only touched when userspace published a new, consistent snapshot */
+static enum hrtimer_restart leds_shm_timer(struct hrtimer *timer){
+    /* the timer is cancelled before drvdata is cleared, it never runs without it */
+    struct leds_drvdata *drvdata = container_of(timer, struct leds_shm_state, timer)->drvdata;
+    struct rgbleds_shm *shm = drvdata->shm;
+    struct rgbleds_shm_led *leds = drvdata->shm_snapshot;
+    int num = min(drvdata->num_leds, RGBLEDS_SHM_MAX_LEDS);
+    unsigned int brightness;
+    unsigned long flags;
+    u32 seq;
+    int i;
+
+    seq = smp_load_acquire(&shm->seq);
+    if (!(seq & 1) && seq != drvdata->shm_seq){
+        for (i = 0; i < num; ++i){
+            leds[i].on = READ_ONCE(shm->leds[i].on);
+            leds[i].brightness = READ_ONCE(shm->leds[i].brightness);
+        }
+        smp_rmb();
+
+        if (READ_ONCE(shm->seq) == seq){
+            spin_lock_irqsave(&drvdata->frame_lock, flags);
+            drvdata->pattern_id = -1;
+            for (i = 0; i < num; ++i){
+                brightness = leds[i].brightness ? leds[i].brightness : LED_PWM_MAX;
+                led_update_locked(drvdata->leds[i], leds[i].on ? brightness : 0);
+            }
+            leds_commit(drvdata);
+            spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+            drvdata->shm_seq = seq;
+            WRITE_ONCE(shm->applied_seq, seq);
+        }
+    }
+
+    hrtimer_forward_now(timer, us_to_ktime(LEDS_SHM_TICK_US));
+    return HRTIMER_RESTART;
+}
+
+static void leds_shm_release(struct kref *ref){
+    kfree(container_of(ref, struct leds_shm_state, ref));
+}
+
+static void leds_shm_get(struct leds_shm_state *state){
+    kref_get(&state->ref);
+    mutex_lock(&state->lock);
+    if (!state->users++ && state->drvdata)
+        hrtimer_start(&state->timer, us_to_ktime(LEDS_SHM_TICK_US), HRTIMER_MODE_REL);
+    mutex_unlock(&state->lock);
+}
+
+static void leds_shm_put(struct leds_shm_state *state){
+    mutex_lock(&state->lock);
+    if (!--state->users)
+        hrtimer_cancel(&state->timer);
+    mutex_unlock(&state->lock);
+    kref_put(&state->ref, leds_shm_release);
+}
+
+/*
+ * the driver lets go of the shared state, the mappings left over keep it (and the page) alive
+ * but nothing applies them anymore. from remove() and, for a failed probe, the devm action, so
+ * only the first call drops the reference
+ */
+static void leds_shm_detach(void *data){
+    struct leds_shm_state *state = data;
+    bool attached;
+
+    mutex_lock(&state->lock);
+    hrtimer_cancel(&state->timer);
+    attached = state->drvdata;
+    state->drvdata = NULL;
+    mutex_unlock(&state->lock);
+    if (attached)
+        kref_put(&state->ref, leds_shm_release);
+}
+
+/* fork and vma splits open another one */
+static void leds_shm_vm_open(struct vm_area_struct *vma){
+    leds_shm_get(vma->vm_private_data);
+}
+
+static void leds_shm_vm_close(struct vm_area_struct *vma){
+    leds_shm_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct leds_shm_vm_ops = {
+    .open = leds_shm_vm_open,
+    .close = leds_shm_vm_close,
+};
+
+/*
+ * maps the shared state page. vm_insert_page() takes a reference on the page and the mapping one
+ * on shm_state, so both stay valid for the mapping even after the driver is unbound
+ */
+static int frame_mmap(struct file *file, struct vm_area_struct *vma){
+    struct leds_drvdata *drvdata = drvdata_from_file(file);
+    int ret_val;
+
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+        return -EINVAL;
+
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+    ret_val = vm_insert_page(vma, vma->vm_start, virt_to_page(drvdata->shm));
+    if (ret_val)
+        return ret_val;
+
+    vma->vm_private_data = drvdata->shm_state;
+    vma->vm_ops = &leds_shm_vm_ops;
+    leds_shm_get(drvdata->shm_state);
+    return 0;
+}
+
+static long frame_do_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
+    struct leds_drvdata *drvdata = drvdata_from_file(file);
+    u32 id;
+
+    switch (cmd){
+    case RGBLEDS_IOC_PATTERN_UPLOAD:
+        return leds_pattern_upload(drvdata, (const void __user *)arg);
+    case RGBLEDS_IOC_PATTERN_PLAY:
+        if (get_user(id, (u32 __user *)arg))
+            return -EFAULT;
+        return leds_pattern_play(drvdata, id);
+    case RGBLEDS_IOC_PATTERN_STOP:
+        leds_pattern_stop(drvdata);
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+static long frame_ioctl(struct file *file, unsigned int cmd, unsigned long arg){
+    struct leds_drvdata *drvdata = drvdata_from_file(file);
+    ktime_t start = ktime_get();
+    long ret_val;
+    u64 ns;
+
+    ret_val = frame_do_ioctl(file, cmd, arg);
+    ns = leds_stats_account(drvdata, LEDS_STAT_IOCTL, start, ret_val);
+    if (trace_rgbleds_ioctl_enabled())
+        trace_rgbleds_ioctl(drvdata->frame_misc_device.name, leds_frame_bank0(drvdata), ret_val, ns);
+    return ret_val;
+}
+
+/*
+ * io_uring passthrough (see rgbleds.h): a frame or a pattern id inline in the sqe, or any of the
+ * ioctls with its argument. everything but PATTERN_UPLOAD only takes frame_lock and completes
+ * inline, the upload allocates with GFP_KERNEL, so when io_uring issues it inline
+ * (IO_URING_F_NONBLOCK) it returns -EAGAIN and is run again from an io-wq worker
+ */
+static int frame_do_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags){
+    struct leds_drvdata *drvdata = drvdata_from_file(ioucmd->file);
+    const struct rgbleds_uring_cmd *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+    u32 frame[RGBLEDS_MAX_BANKS];
+    int i;
+
+    switch (ioucmd->cmd_op){
+    case RGBLEDS_UCMD_FRAME:
+        break;
+    case RGBLEDS_UCMD_PATTERN_PLAY:
+        return leds_pattern_play(drvdata, READ_ONCE(cmd->pattern_id));
+    case RGBLEDS_IOC_PATTERN_UPLOAD:
+        if (issue_flags & IO_URING_F_NONBLOCK)
+            return -EAGAIN;
+        fallthrough;
+    default:
+        /* PATTERN_PLAY reads its id with get_user(), fine from the submitting task */
+        return frame_do_ioctl(ioucmd->file, ioucmd->cmd_op, READ_ONCE(cmd->arg));
+    }
+
+    if (drvdata->num_banks > RGBLEDS_UCMD_SQE_BANKS && !(issue_flags & IO_URING_F_SQE128))
+        return -EINVAL;
+    /* the sqe stays writable by userspace, take one copy */
+    for (i = 0; i < drvdata->num_banks; ++i)
+        frame[i] = READ_ONCE(cmd->frame[i]);
+    return leds_set_frame(drvdata, frame);
+}
+
+static int frame_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags){
+    struct leds_drvdata *drvdata = drvdata_from_file(ioucmd->file);
+    ktime_t start = ktime_get();
+    int ret_val;
+    u64 ns;
+
+    ret_val = frame_do_uring_cmd(ioucmd, issue_flags);
+    if (ret_val == -EAGAIN && (issue_flags & IO_URING_F_NONBLOCK))
+        return ret_val;
+    ns = leds_stats_account(drvdata, LEDS_STAT_IOCTL, start, ret_val);
+    if (trace_rgbleds_ioctl_enabled())
+        trace_rgbleds_ioctl(drvdata->frame_misc_device.name, leds_frame_bank0(drvdata), ret_val, ns);
+    return ret_val;
+}
+
+static const struct file_operations frame_fops = {
     .owner = THIS_MODULE,
-    .write = led_write,
-    .read = led_read,
+    .open = frame_open,
+    .release = leds_release,
+    .write = frame_write,
+    .read = frame_read,
+    .llseek = default_llseek,
+    .poll = frame_poll,
+    .unlocked_ioctl = frame_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .mmap = frame_mmap,
+    .uring_cmd = frame_uring_cmd,
+};
+
+/* "max_ns avg_ns samples" of the PWM period error, any write resets it */
+static ssize_t pwm_jitter_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct leds_drvdata *drvdata = container_of(misc, struct leds_drvdata, frame_misc_device);
+    u64 max_ns, sum_ns, samples;
+    unsigned long flags;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    max_ns = drvdata->pwm_jitter_max_ns;
+    sum_ns = drvdata->pwm_jitter_sum_ns;
+    samples = drvdata->pwm_jitter_samples;
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    return sysfs_emit(buf, "%llu %llu %llu\n", max_ns, samples ? div64_u64(sum_ns, samples) : 0, samples);
+}
+
+static ssize_t pwm_jitter_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct leds_drvdata *drvdata = container_of(misc, struct leds_drvdata, frame_misc_device);
+    unsigned long flags;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    drvdata->pwm_jitter_max_ns = 0;
+    drvdata->pwm_jitter_sum_ns = 0;
+    drvdata->pwm_jitter_samples = 0;
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    return count;
+}
+static DEVICE_ATTR_RW(pwm_jitter);
+
+/* name of the pattern playing ("none" when idle), writing a name plays it, "none" stops */
+static ssize_t pattern_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct leds_drvdata *drvdata = container_of(misc, struct leds_drvdata, frame_misc_device);
+    char name[LED_PATTERN_NAME_LEN] = "none";
+    unsigned long flags;
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    if (drvdata->pattern_id >= 0)
+        strscpy(name, drvdata->patterns[drvdata->pattern_id].name, sizeof(name));
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+
+    return sysfs_emit(buf, "%s\n", name);
+}
+
+static ssize_t pattern_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct leds_drvdata *drvdata = container_of(misc, struct leds_drvdata, frame_misc_device);
+    char kbuf[LED_PATTERN_NAME_LEN];
+    unsigned long flags;
+    char *name;
+    int ret_val;
+    int id;
+
+    strscpy(kbuf, buf, sizeof(kbuf));
+    name = strim(kbuf);
+
+    if (!strcmp(name, "none")){
+        leds_pattern_stop(drvdata);
+        return count;
+    }
+
+    spin_lock_irqsave(&drvdata->frame_lock, flags);
+    id = leds_pattern_find_locked(drvdata, name);
+    spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+    if (id < 0)
+        return id;
+
+    ret_val = leds_pattern_play(drvdata, id);
+    return ret_val ? ret_val : count;
+}
+static DEVICE_ATTR_RW(pattern);
+
+/*
+ * write-to-pin latency of the different write paths, every write is followed by a read of
+ * the pin so that the posted PCIe write has reached RP1 before the next one.
+ * writing N runs N toggles of the first LED per path, reading shows ns per toggle.
+ * legacy is the old integer GPIO path (gpio_set_value() looks the descriptor up every time).
+ */
+static ssize_t write_latency_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct leds_drvdata *drvdata = container_of(misc, struct leds_drvdata, frame_misc_device);
+
+    return sysfs_emit(buf, "legacy=%llu gpiod=%llu array=%llu rio=%llu\n",
+                      drvdata->bench_ns[0], drvdata->bench_ns[1], drvdata->bench_ns[2], drvdata->bench_ns[3]);
+}
+
+#define LEDS_BENCH_BATCH 256
+
+static ssize_t write_latency_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+    struct miscdevice *misc = dev_get_drvdata(dev);
+    struct leds_drvdata *drvdata = container_of(misc, struct leds_drvdata, frame_misc_device);
+    struct gpio_desc *desc;
+    struct leds_bank *bank;
+    unsigned int iterations, done, n, path;
+    unsigned long flags;
+    u64 elapsed[4] = {};
+    u32 mask, saved;
+    int gpio;
+    int ret_val;
+    u64 start;
+
+    ret_val = kstrtouint(buf, 0, &iterations);
+    if (ret_val)
+        return ret_val;
+    if (!iterations || iterations > 1000000 || !drvdata->num_leds)
+        return -EINVAL;
+    /* the paths below run under frame_lock, drv_bench led-write measures sleeping controllers */
+    if (drvdata->can_sleep)
+        return -EOPNOTSUPP;
+
+    desc = drvdata->descs[0];
+    gpio = desc_to_gpio(desc);
+    mask = drvdata->leds[0]->led_mask;
+    bank = drvdata->leds[0]->bank;
+
+    /* batches keep the irqs-off window short, the PWM and pattern timers wait meanwhile */
+    for (done = 0; done < iterations; done += n){
+        n = min(iterations - done, LEDS_BENCH_BATCH);
+        spin_lock_irqsave(&drvdata->frame_lock, flags);
+        saved = bank->out;
+        for (path = 0; path < 4; ++path){
+            unsigned int k;
+
+            if (path == 3 && !bank->rio)
+                break;
+            start = ktime_get_ns();
+            for (k = 0; k < n; ++k){
+                switch (path){
+                case 0:
+                    gpio_set_value(gpio, k & 1);
+                    gpio_get_value(gpio);
+                    break;
+                case 1:
+                    gpiod_set_value(desc, k & 1);
+                    gpiod_get_value(desc);
+                    break;
+                case 2:
+                    bitmap_zero(drvdata->values, drvdata->num_leds);
+                    if (k & 1)
+                        __set_bit(0, drvdata->values);
+                    gpiod_set_array_value(1, drvdata->descs, NULL, drvdata->values);
+                    gpiod_get_value(desc);
+                    break;
+                case 3:
+                    writel(mask, bank->rio + ((k & 1) ? RP1_RIO_SET : RP1_RIO_CLR) + RP1_RIO_OUT);
+                    readl(bank->rio + RP1_RIO_IN);
+                    break;
+                }
+            }
+            elapsed[path] += ktime_get_ns() - start;
+        }
+        /* put the LED back to what it was before the batch */
+        gpiod_set_value(desc, !!(saved & mask));
+        spin_unlock_irqrestore(&drvdata->frame_lock, flags);
+        cond_resched();
+    }
+
+    for (path = 0; path < 4; ++path)
+        drvdata->bench_ns[path] = div_u64(elapsed[path], iterations);
+
+    return count;
+}
+static DEVICE_ATTR_RW(write_latency);
+
+static struct attribute *frame_attrs[] = {
+    &dev_attr_pwm_jitter.attr,
+    &dev_attr_write_latency.attr,
+    &dev_attr_pattern.attr,
+    NULL,
 };
+ATTRIBUTE_GROUPS(frame);
+
+/* drops our reference only, existing mappings keep the page alive */
+static void leds_shm_free(void *shm){
+    free_page((unsigned long)shm);
+}
+
+/*
+ * finds the bank of the pin in the gpios property of the LED node (adding it on first use)
+ * and sets the LED mask from the pin number. called once the GPIO of the LED is held
+ */
+static int leds_parse_pin(struct leds_drvdata *drvdata, struct device_node *child, struct led_dev *led_device){
+    struct of_phandle_args args;
+    struct leds_bank *bank = NULL;
+    u32 num;
+    int ret_val;
+    int i;
+
+    ret_val = of_parse_phandle_with_args(child, "gpios", "#gpio-cells", 0, &args);
+    if (ret_val)
+        return ret_val;
+    of_node_put(args.np);
+    if (!args.args_count)
+        return -EINVAL;
+
+    num = args.args[0] / LEDS_BANK_WIDTH;
+    for (i = 0; i < drvdata->num_banks; ++i){
+        if (drvdata->banks[i].chip_np == args.np && drvdata->banks[i].num == num){
+            bank = &drvdata->banks[i];
+            break;
+        }
+    }
+    if (!bank){
+        if (drvdata->num_banks == RGBLEDS_MAX_BANKS)
+            return -ENOSPC;
+        bank = &drvdata->banks[drvdata->num_banks++];
+        bank->chip_np = args.np;
+        bank->num = num;
+    }
+
+    led_device->bank = bank;
+    led_device->led_mask = BIT(args.args[0] % LEDS_BANK_WIDTH);
+    return 0;
+}
+
+/*
+ * fast mode: the reg of the leds node is the RIO block of RP1 bank 0, so all LEDs have to be on
+ * GPIO 0-27 of one controller. a pin of another RP1 bank would set a bit in the wrong block, such
+ * a panel stays on gpiolib. the registers are not requested as the RP1 pinctrl driver already
+ * owns that range.
+ */
+static void leds_setup_fast_mode(struct platform_device *pdev, struct leds_drvdata *drvdata){
+    struct leds_bank *bank;
+    struct resource *res;
+    int i;
+
+    for (i = 0; i < drvdata->num_leds; ++i){
+        bank = drvdata->leds[i]->bank;
+        if (bank != &drvdata->banks[0] || bank->num || (drvdata->leds[i]->led_mask & ~GENMASK(RP1_BANK0_PINS - 1, 0))){
+            pr_warn("fast mode needs all LEDs on GPIO 0-%d of one controller (RP1 bank 0), using gpiolib\n",
+                    RP1_BANK0_PINS - 1);
+            return;
+        }
+    }
+
+    bank = &drvdata->banks[0];
+    res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+    if (res)
+        bank->rio = devm_ioremap(&pdev->dev, res->start, resource_size(res));
+    if (!bank->rio){
+        pr_warn("fast mode needs a reg entry with the RIO block of RP1 bank 0, using gpiolib\n");
+        return;
+    }
+    pr_info("fast mode: bank 0 on RP1 RIO registers at %pa\n", &res->start);
+    drvdata->fast = true;
+}
 
 static const struct of_device_id leds_of_match[] = {
     { .compatible = "arrow,RGBleds" },
@@ -87,24 +1733,184 @@ static const struct of_device_id leds_of_match[] = {
 };
 MODULE_DEVICE_TABLE(of, leds_of_match);
 
+/*
+ * debugfs <name of the leds device>/stats: "op calls N errors N bytes N" per operation followed
+ * by its non empty latency buckets, summed over all CPUs. any write resets the counters, updates
+ * racing with the reset on other CPUs may survive it
+ */
+static int leds_stats_show(struct seq_file *m, void *v){
+    struct leds_drvdata *drvdata = m->private;
+    struct leds_pcpu_stats *p;
+    u64 calls, errors, bytes, hist[LEDS_HIST_BUCKETS];
+    int cpu, op, b;
+
+    for (op = 0; op < LEDS_STAT_OPS; op++){
+        calls = errors = bytes = 0;
+        memset(hist, 0, sizeof(hist));
+        for_each_possible_cpu(cpu){
+            p = per_cpu_ptr(drvdata->stats, cpu);
+            calls += READ_ONCE(p->calls[op]);
+            errors += READ_ONCE(p->errors[op]);
+            bytes += READ_ONCE(p->bytes[op]);
+            for (b = 0; b < LEDS_HIST_BUCKETS; b++)
+                hist[b] += READ_ONCE(p->hist[op][b]);
+        }
+
+        seq_printf(m, "%s calls %llu errors %llu bytes %llu\n", leds_stat_names[op], calls, errors, bytes);
+        for (b = 0; b < LEDS_HIST_BUCKETS; b++){
+            if (hist[b])
+                seq_printf(m, "  %12llu ns: %llu\n", 1ULL << b, hist[b]);
+        }
+    }
+    return 0;
+}
+
+static int leds_stats_open(struct inode *inode, struct file *file){
+    return single_open(file, leds_stats_show, inode->i_private);
+}
+
+static ssize_t leds_stats_write(struct file *file, const char __user *buff, size_t count, loff_t *ppos){
+    struct seq_file *m = file->private_data;
+    struct leds_drvdata *drvdata = m->private;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(drvdata->stats, cpu), 0, sizeof(struct leds_pcpu_stats));
+    return count;
+}
+
+static const struct file_operations leds_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = leds_stats_open,
+    .read = seq_read,
+    .write = leds_stats_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static void leds_debugfs_remove(void *data){
+    debugfs_remove_recursive(data);
+}
+
+/* debugfs is optional, the counters work without it */
+static int leds_debugfs_init(struct leds_drvdata *drvdata, struct device *dev){
+    struct dentry *dir;
+
+    dir = debugfs_create_dir(dev_name(dev), NULL);
+    debugfs_create_file("stats", 0600, dir, drvdata, &leds_stats_fops);
+    return devm_add_action_or_reset(dev, leds_debugfs_remove, dir);
+}
+
+/*
+ * registers /dev/<label> and the LED class device of every LED. misc_register() creates the
+ * device, its sysfs files and the node through the uevent, with many LEDs that is the bulk of
+ * the probe time. nothing on the boot path waits for the per LED nodes (the frame node and the
+ * pins are ready when probe returns), so they are left to a worker. a LED whose node failed
+ * stays usable through /dev/rgbleds
+ */
+static void leds_nodes_work(struct work_struct *work){
+    struct leds_drvdata *drvdata = container_of(work, struct leds_drvdata, nodes_work);
+    struct led_dev *led_device;
+    int ret_val;
+    int i;
+
+    for (i = 0; i < drvdata->num_leds; ++i){
+        led_device = drvdata->leds[i];
+        ret_val = misc_register(&led_device->led_misc_device);
+        if (ret_val){
+            pr_err("failed to register misc device for %s: %d\n", led_device->led_name, ret_val);
+            continue;
+        }
+        led_device->registered = true;
+        pr_debug("Registered misc device: /dev/%s\n", led_device->led_misc_device.name);
+
+        /* the default trigger of the DT node is attached by the registration */
+        ret_val = led_classdev_register(drvdata->dev, &led_device->cdev);
+        if (ret_val){
+            pr_err("failed to register LED class device for %s: %d\n", led_device->led_name, ret_val);
+            continue;
+        }
+        led_device->cdev_registered = true;
+    }
+}
+
 static int leds_probe(struct platform_device *pdev) {
 //    struct led_dev *led_device;
-    struct device_node *child;
+    ktime_t probe_start = ktime_get();
+    int num_children;
     int ret_val;
-    int gpio;
 
-    pr_info("leds_probe() called for device: %s\n", dev_name(&pdev->dev));
+    dev_dbg(&pdev->dev, "leds_probe() called\n");
 
     struct leds_drvdata *drvdata;
     struct led_dev *led_device;
     drvdata = devm_kzalloc(&pdev->dev, sizeof(*drvdata), GFP_KERNEL);
     if (!drvdata)
         return -ENOMEM;
+    drvdata->dev = &pdev->dev;
+    spin_lock_init(&drvdata->frame_lock);
+    hrtimer_init(&drvdata->pwm_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    drvdata->pwm_timer.function = leds_pwm_timer;
+    hrtimer_init(&drvdata->pattern_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    drvdata->pattern_timer.function = leds_pattern_timer;
+    drvdata->pattern_id = -1;
+    INIT_WORK(&drvdata->commit_work, leds_commit_work);
+    INIT_WORK(&drvdata->nodes_work, leds_nodes_work);
 
-    for_each_child_of_node(pdev->dev.of_node, child){
-        if (drvdata->num_leds >= MAX_LEDS)
-            break;
+    /* not devm memory, open files keep it */
+    drvdata->waiters = kzalloc(sizeof(*drvdata->waiters), GFP_KERNEL);
+    if (!drvdata->waiters)
+        return -ENOMEM;
+    kref_init(&drvdata->waiters->ref);
+    init_waitqueue_head(&drvdata->waiters->wait);
+    init_rwsem(&drvdata->waiters->lock);
+    ret_val = devm_add_action_or_reset(&pdev->dev, leds_waiters_put, drvdata->waiters);
+    if (ret_val)
+        return ret_val;
+
+    BUILD_BUG_ON(sizeof(struct rgbleds_shm) > PAGE_SIZE);
+    drvdata->shm = (struct rgbleds_shm *)get_zeroed_page(GFP_KERNEL);
+    if (!drvdata->shm)
+        return -ENOMEM;
+    ret_val = devm_add_action_or_reset(&pdev->dev, leds_shm_free, drvdata->shm);
+    if (ret_val)
+        return ret_val;
+
+    /* not devm memory, the mappings may need it after the driver is gone */
+    drvdata->shm_state = kzalloc(sizeof(*drvdata->shm_state), GFP_KERNEL);
+    if (!drvdata->shm_state)
+        return -ENOMEM;
+    kref_init(&drvdata->shm_state->ref);
+    mutex_init(&drvdata->shm_state->lock);
+    hrtimer_init(&drvdata->shm_state->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    drvdata->shm_state->timer.function = leds_shm_timer;
+    drvdata->shm_state->drvdata = drvdata;
+    ret_val = devm_add_action_or_reset(&pdev->dev, leds_shm_detach, drvdata->shm_state);
+    if (ret_val)
+        return ret_val;
+
+    drvdata->stats = devm_alloc_percpu(&pdev->dev, struct leds_pcpu_stats);
+    if (!drvdata->stats)
+        return -ENOMEM;
+    ret_val = leds_debugfs_init(drvdata, &pdev->dev);
+    if (ret_val)
+        return ret_val;
+
+    /* everything per LED is sized from the DT, a panel can carry any number of LEDs */
+    num_children = of_get_available_child_count(pdev->dev.of_node);
+    if (!num_children)
+        return -ENODEV;
+    drvdata->leds = devm_kcalloc(&pdev->dev, num_children, sizeof(*drvdata->leds), GFP_KERNEL);
+    drvdata->descs = devm_kcalloc(&pdev->dev, num_children, sizeof(*drvdata->descs), GFP_KERNEL);
+    drvdata->shm_snapshot = devm_kcalloc(&pdev->dev, num_children, sizeof(*drvdata->shm_snapshot), GFP_KERNEL);
+    drvdata->values = devm_bitmap_zalloc(&pdev->dev, num_children, GFP_KERNEL);
+    drvdata->pwm_active = devm_bitmap_zalloc(&pdev->dev, num_children, GFP_KERNEL);
+    drvdata->work_values = devm_bitmap_zalloc(&pdev->dev, num_children, GFP_KERNEL);
+    if (!drvdata->leds || !drvdata->descs || !drvdata->shm_snapshot || !drvdata->values || !drvdata->pwm_active ||
+        !drvdata->work_values)
+        return -ENOMEM;
 
+    for_each_available_child_of_node_scoped(pdev->dev.of_node, child){
         led_device = devm_kzalloc(&pdev->dev, sizeof(*led_device), GFP_KERNEL);
         if (!led_device)
             return -ENOMEM;
@@ -119,70 +1925,122 @@ static int leds_probe(struct platform_device *pdev) {
         led_device->led_misc_device.minor = MISC_DYNAMIC_MINOR;
         led_device->led_misc_device.name = led_device->led_name;
         led_device->led_misc_device.fops = &led_fops;
+        led_device->led_misc_device.groups = led_groups;
+        led_device->pwm_freq = LED_PWM_DEFAULT_FREQ;
+        led_device->pwm_period_ns = NSEC_PER_SEC / LED_PWM_DEFAULT_FREQ;
 
-        if (strcmp(led_device->led_name, "ledred") == 0)
-            led_device->led_mask = 1 << (27 % 32);
-        else if (strcmp(led_device->led_name, "ledgreen") == 0)
-            led_device->led_mask = 1 << (22 % 32);
-        else if (strcmp(led_device->led_name, "ledblue") == 0)
-            led_device->led_mask = 1 << (26 % 32);
-        else {
-            pr_warn("unknown led lavel: %s\n", led_device->led_name);
-            //return -EINVAL;
-            continue;
-        }
-
-        ret_val = misc_register(&led_device->led_misc_device); 
+        /* /sys/class/leds/rgbleds:<label>, eg. linux,default-trigger = "heartbeat" in the DT */
+        led_device->cdev.name = devm_kasprintf(&pdev->dev, GFP_KERNEL, "rgbleds:%s", led_device->led_name);
+        if (!led_device->cdev.name)
+            return -ENOMEM;
+        led_device->cdev.max_brightness = LED_PWM_MAX;
+        led_device->cdev.brightness_set = led_cdev_brightness_set;
+        led_device->cdev.brightness_get = led_cdev_brightness_get;
+        led_device->cdev.blink_set = led_cdev_blink_set;
+        of_property_read_string(child, "linux,default-trigger", &led_device->cdev.default_trigger);
 
-        if (ret_val) {
-            pr_err("failed to register misc device for %s", led_device->led_name);
+        /* the GPIO is requested before the node exists, so every LED in leds[] has a valid pin
+         * and the same index in descs[] for the frame writes. the descriptor is cached, the
+         * write path never looks the pin up again */
+        led_device->gpiod = devm_fwnode_gpiod_get(&pdev->dev, of_fwnode_handle(child), NULL,
+                                                  GPIOD_OUT_LOW, led_device->led_name);
+        if (IS_ERR(led_device->gpiod)){
+            /* the GPIO controller isn't there yet (eg. an i2c expander), try the whole probe again later */
+            if (PTR_ERR(led_device->gpiod) == -EPROBE_DEFER)
+                return dev_err_probe(&pdev->dev, -EPROBE_DEFER, "GPIO for %s not ready\n",
+                                     led_device->led_name);
+            pr_err("failed to get GPIO for %s\n", led_device->led_name);
             continue;
         }
 
-        drvdata->leds[drvdata->num_leds++] = led_device;
-        pr_info("Registered misc device: /dev/%s\n", led_device->led_misc_device.name);
-
-       // led_device->gpiod = devm_gpiod_get(&pdev->dev, led_device->led_name, GPIOD_OUT_LOW);
-        //if (IS_ERR(led_device->gpiod)){
-          //  pr_err("failed to get GPIO for %s\n", led_device->led_name);
-           // continue;
-        //}
-        gpio = of_get_named_gpio(child, "gpios", 0);
-        if (gpio < 0){
-            pr_err("failed to get gpio from DT for %s\n", led_device->led_name);
-            continue;
-        }
-        ret_val = devm_gpio_request_one(&pdev->dev, gpio, GPIOF_OUT_INIT_LOW, led_device->led_name);
+        /* only a LED which got its pin adds a bank, a skipped one would grow the frame */
+        ret_val = leds_parse_pin(drvdata, child, led_device);
         if (ret_val){
-            pr_err("failed to request GPIO %d for %s\n", gpio, led_device->led_name);
+            pr_err("failed to parse gpios of %s: %d\n", led_device->led_name, ret_val);
+            devm_gpiod_put(&pdev->dev, led_device->gpiod);
             continue;
         }
-        led_device->gpio_num = gpio;
+        led_device->drvdata = drvdata;
+        led_device->index = drvdata->num_leds;
+
+        if (gpiod_cansleep(led_device->gpiod))
+            drvdata->can_sleep = true;
+        drvdata->descs[drvdata->num_leds] = led_device->gpiod;
+        drvdata->leds[drvdata->num_leds++] = led_device;
+        if (gpiod_is_active_low(led_device->gpiod))
+            led_device->bank->active_low_mask |= led_device->led_mask;
+    }
+
+    if (fast_mode)
+        leds_setup_fast_mode(pdev, drvdata);
+    pr_info("%d LEDs in %d banks%s\n", drvdata->num_leds, drvdata->num_banks,
+            drvdata->can_sleep ? ", pins written from a worker" : "");
 
+    drvdata->frame_misc_device.minor = MISC_DYNAMIC_MINOR;
+    drvdata->frame_misc_device.name = "rgbleds";
+    drvdata->frame_misc_device.fops = &frame_fops;
+    drvdata->frame_misc_device.groups = frame_groups;
+
+    ret_val = misc_register(&drvdata->frame_misc_device);
+    if (ret_val){
+        pr_err("failed to register misc device rgbleds\n");
+        hrtimer_cancel(&drvdata->pattern_timer);
+        hrtimer_cancel(&drvdata->pwm_timer);
+        cancel_work_sync(&drvdata->commit_work);
+        return ret_val;
     }
+    dev_dbg(&pdev->dev, "Registered misc device: /dev/%s\n", drvdata->frame_misc_device.name);
 
    // platform_set_drvdata(pdev, led_device);
     platform_set_drvdata(pdev, drvdata);
+    queue_work(system_unbound_wq, &drvdata->nodes_work);
+
+    /* boot time budget: what the probe itself cost, the per LED nodes come after this */
+    dev_info(&pdev->dev, "probe took %lld us\n", ktime_us_delta(ktime_get(), probe_start));
     return 0;
 }
 
 static void leds_remove(struct platform_device *pdev) {
     //struct led_dev *led_device = platform_get_drvdata(pdev);
     struct leds_drvdata *drvdata = platform_get_drvdata(pdev);
+    u32 off_frame[RGBLEDS_MAX_BANKS] = {};
     int i;
 
     if(!drvdata){
         pr_err("Driver data is null!\n");
         return;
     }
-    pr_info("leds_remove() called for device:%s\n", dev_name(&pdev->dev));
-    pr_info("Removing %d LEDs\n", drvdata->num_leds);
+    dev_dbg(&pdev->dev, "leds_remove() called\n");
+    dev_dbg(&pdev->dev, "Removing %d LEDs\n", drvdata->num_leds);
+    /* the per LED nodes may still be on their way */
+    cancel_work_sync(&drvdata->nodes_work);
+    misc_deregister(&drvdata->frame_misc_device);
     for (i=0; i < drvdata->num_leds; ++i){
-        if(drvdata->leds[i]){
+        /* turns the LED off and detaches its trigger, on sleeping lines the pins follow in commit_work */
+        if (drvdata->leds[i]->cdev_registered)
+            led_classdev_unregister(&drvdata->leds[i]->cdev);
+        if(drvdata->leds[i]->registered){
             misc_deregister(&drvdata->leds[i]->led_misc_device);
-            pr_info("Deregistered misc device: /dev/%s\n", drvdata->leds[i]->led_misc_device.name);
+            dev_dbg(&pdev->dev, "Deregistered misc device: /dev/%s\n", drvdata->leds[i]->led_misc_device.name);
         }
     }
+    /* nothing can open a node anymore, the files still open let go of drvdata */
+    leds_waiters_gone(drvdata->waiters);
+    /* no node is left to restart them, the pattern goes first as it can kick the PWM timer */
+    leds_shm_detach(drvdata->shm_state);
+    hrtimer_cancel(&drvdata->pattern_timer);
+    /*
+     * every LED off, also the ones without a class device and the ones on the PWM, which stops
+     * with it. nothing is left that could turn one on again
+     */
+    if (leds_set_frame(drvdata, off_frame))
+        pr_warn("could not turn the LEDs off\n");
+    hrtimer_cancel(&drvdata->pwm_timer);
+    /*
+     * the off above (and the timers before it) may have queued it one last time, on sleeping
+     * lines that write is the off, so it is run rather than dropped
+     */
+    flush_work(&drvdata->commit_work);
 
 }
     //pr_info("leds_remove() called for device: %s\n", dev_name(&pdev->dev));
@@ -197,6 +2055,8 @@ static struct platform_driver leds_driver = {
         .name = "rgb-leds-driver",
         .of_match_table = leds_of_match,
         .owner = THIS_MODULE,
+        /* nothing at boot waits for the LEDs, they probe in parallel with other drivers */
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
     }
 };
 
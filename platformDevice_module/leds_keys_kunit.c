@@ -0,0 +1,421 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * leds_keys_kunit: KUnit tests of leds_driver and hellokeys on simulated GPIO lines (gpio-sim)
+ *
+ * every test applies leds_keys_kunit.dtso, a gpio-sim device with a LED and a key bank and a leds
+ * and a hellokeys node on them, waits for the drivers to bind and removes it again afterwards, so
+ * the unbind path runs as well. the lines are driven and read through the gpio-sim sysfs files,
+ * the drivers are used through their nodes like a process would, from a user buffer mapped by
+ * kunit_vm_mmap(), and the test asserts what ends up on the lines and in the events:
+ *  led_node    a write to /dev/kunit_red sets line 0, a read returns the record and then EOF
+ *  frame       every frame 0..7 on /dev/rgbleds shows up on the three LED lines
+ *  key_events  pulling a key line gives a press and a release on /dev/hellokeys, in order and with
+ *              timestamps between the pull and the read
+ *  capture     the edges of a selected key show up in the /dev/hellokeys_capture stream after a
+ *              SYNC, with the raw levels and timestamps, and the sampler is refused without a reg
+ *
+ * needs CONFIG_KUNIT, CONFIG_OF_OVERLAY, CONFIG_GPIO_SIM and devtmpfs on /dev, with leds_driver
+ * and hellokeys loaded and not bound to another node (the node names of both are fixed).
+ * results in dmesg and /sys/kernel/debug/kunit/leds_keys/results, see SIM_README
+ */
+#include <kunit/test.h>
+#include <kunit/of.h>
+#include <linux/module.h>
+#include <linux/of.h>
+#include <linux/of_platform.h>
+#include <linux/platform_device.h>
+#include <linux/gpio/driver.h>
+#include <linux/fs.h>
+#include <linux/mman.h>
+#include <linux/uaccess.h>
+#include <linux/delay.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "hellokeys.h"
+
+#define LEDS_KEYS_TIMEOUT_MS	1000
+#define LEDS_KEYS_PATH_LEN	128
+#define LEDS_KEYS_CAPTURE_ATTR	"/sys/class/misc/hellokeys_capture/"
+
+struct leds_keys_ctx {
+	char led_chip[LEDS_KEYS_PATH_LEN];	/* sysfs directory of the LED bank */
+	char key_chip[LEDS_KEYS_PATH_LEN];
+	char __user *ubuf;			/* what the driver nodes read into and write from */
+};
+
+static void leds_keys_close(void *file){
+	filp_close(file, NULL);
+}
+
+static void leds_keys_put_device(void *dev){
+	put_device(dev);
+}
+
+/* device nodes come up from a worker (the LED nodes) and devtmpfs, give them some time */
+static struct file *leds_keys_open(struct kunit *test, const char *path, int flags){
+	unsigned long end = jiffies + msecs_to_jiffies(LEDS_KEYS_TIMEOUT_MS);
+	struct file *file;
+
+	for (;;){
+		file = filp_open(path, flags, 0);
+		if (!IS_ERR(file) || PTR_ERR(file) != -ENOENT || time_after(jiffies, end))
+			break;
+		msleep(10);
+	}
+	KUNIT_ASSERT_NOT_ERR_OR_NULL_MSG(test, file, "open %s", path);
+	KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, leds_keys_close, file), 0);
+	return file;
+}
+
+/* the driver nodes only have ->read/->write, so they are called with the mapped user buffer */
+static ssize_t leds_keys_read(struct kunit *test, struct file *file, void *buf, size_t len, loff_t *pos){
+	struct leds_keys_ctx *ctx = test->priv;
+	ssize_t ret;
+
+	ret = file->f_op->read(file, ctx->ubuf, len, pos);
+	if (ret > 0 && copy_from_user(buf, ctx->ubuf, ret))
+		return -EFAULT;
+	return ret;
+}
+
+static ssize_t leds_keys_write(struct kunit *test, struct file *file, const void *buf, size_t len){
+	struct leds_keys_ctx *ctx = test->priv;
+	loff_t pos = 0;
+
+	if (copy_to_user(ctx->ubuf, buf, len))
+		return -EFAULT;
+	return file->f_op->write(file, ctx->ubuf, len, &pos);
+}
+
+/* sysfs attributes have ->read_iter/->write_iter, returns 0 or -errno */
+static int leds_keys_write_attr(const char *path, const char *value){
+	struct file *file;
+	loff_t pos = 0;
+	ssize_t ret;
+
+	file = filp_open(path, O_WRONLY, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	ret = kernel_write(file, value, strlen(value), &pos);
+	filp_close(file, NULL);
+	return ret < 0 ? ret : 0;
+}
+
+/* level of a simulated line, -1 when it can't be read */
+static int leds_keys_line(const char *chip, int line){
+	char path[LEDS_KEYS_PATH_LEN + 32], buf[4] = "";
+	struct file *file;
+	loff_t pos = 0;
+	ssize_t ret;
+
+	snprintf(path, sizeof(path), "%s/sim_gpio%d/value", chip, line);
+	file = filp_open(path, O_RDONLY, 0);
+	if (IS_ERR(file))
+		return -1;
+	ret = kernel_read(file, buf, sizeof(buf) - 1, &pos);
+	filp_close(file, NULL);
+	if (ret < 1)
+		return -1;
+	return buf[0] == '1' ? 1 : buf[0] == '0' ? 0 : -1;
+}
+
+/* LEDs on sleeping lines are written from a worker */
+static int leds_keys_wait_line(const char *chip, int line, int want){
+	unsigned long end = jiffies + msecs_to_jiffies(LEDS_KEYS_TIMEOUT_MS);
+	int value;
+
+	for (;;){
+		value = leds_keys_line(chip, line);
+		if (value == want || time_after(jiffies, end))
+			return value;
+		usleep_range(500, 1000);
+	}
+}
+
+/* active low keys: pull-down is a press */
+static int leds_keys_pull(struct kunit *test, int line, bool press){
+	struct leds_keys_ctx *ctx = test->priv;
+	char path[LEDS_KEYS_PATH_LEN + 32];
+
+	snprintf(path, sizeof(path), "%s/sim_gpio%d/pull", ctx->key_chip, line);
+	return leds_keys_write_attr(path, press ? "pull-down" : "pull-up");
+}
+
+/* next event from a O_NONBLOCK file of /dev/hellokeys, -ETIMEDOUT when none comes */
+static int leds_keys_event(struct kunit *test, struct file *file, struct hellokeys_event *ev){
+	unsigned long end = jiffies + msecs_to_jiffies(LEDS_KEYS_TIMEOUT_MS);
+	loff_t pos = 0;
+	ssize_t ret;
+
+	for (;;){
+		ret = leds_keys_read(test, file, ev, sizeof(*ev), &pos);
+		if (ret != -EAGAIN)
+			return ret == sizeof(*ev) ? 0 : ret < 0 ? ret : -EIO;
+		if (time_after(jiffies, end))
+			return -ETIMEDOUT;
+		usleep_range(500, 1000);
+	}
+}
+
+static void leds_keys_drain(struct kunit *test, struct file *file){
+	struct hellokeys_event ev;
+	loff_t pos = 0;
+
+	while (leds_keys_read(test, file, &ev, sizeof(ev), &pos) > 0)
+		;
+}
+
+/* the device of a node of the overlay once its driver is bound */
+static struct device *leds_keys_bound(struct kunit *test, const char *path){
+	unsigned long end = jiffies + msecs_to_jiffies(LEDS_KEYS_TIMEOUT_MS);
+	struct platform_device *pdev;
+	struct device_node *np;
+
+	np = of_find_node_by_path(path);
+	KUNIT_ASSERT_NOT_NULL_MSG(test, np, "%s is not in the live tree", path);
+	pdev = of_find_device_by_node(np);
+	of_node_put(np);
+	KUNIT_ASSERT_NOT_NULL_MSG(test, pdev, "no platform device for %s", path);
+	KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, leds_keys_put_device, &pdev->dev), 0);
+
+	/* both drivers probe asynchronously, the leds and keys defer until gpio-sim is there */
+	while (!READ_ONCE(pdev->dev.driver) && time_before(jiffies, end))
+		msleep(10);
+	KUNIT_ASSERT_NOT_NULL_MSG(test, READ_ONCE(pdev->dev.driver), "%s did not bind, is its driver loaded?", path);
+	return &pdev->dev;
+}
+
+/* "/sys/devices/platform/gpio-sim-kunit/gpiochipN" of a bank */
+static void leds_keys_chip(struct kunit *test, const char *bank, char *dir){
+	struct gpio_device *gdev;
+	struct device_node *np;
+	char *path;
+
+	np = of_find_node_by_path(bank);
+	KUNIT_ASSERT_NOT_NULL(test, np);
+	gdev = gpio_device_find_by_fwnode(of_fwnode_handle(np));
+	of_node_put(np);
+	KUNIT_ASSERT_NOT_NULL_MSG(test, gdev, "no gpio chip for %s", bank);
+	path = kobject_get_path(&gpio_device_to_device(gdev)->kobj, GFP_KERNEL);
+	gpio_device_put(gdev);
+	KUNIT_ASSERT_NOT_NULL(test, path);
+	snprintf(dir, LEDS_KEYS_PATH_LEN, "/sys%s", path);
+	kfree(path);
+}
+
+static int leds_keys_init(struct kunit *test){
+	struct leds_keys_ctx *ctx;
+	unsigned long ubuf;
+
+	of_root_kunit_skip(test);
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx);
+	test->priv = ctx;
+
+	ubuf = kunit_vm_mmap(test, NULL, 0, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	KUNIT_ASSERT_NE_MSG(test, ubuf, 0, "could not map a user buffer");
+	ctx->ubuf = (char __user *)ubuf;
+
+	/* removed again when the test ends, which unbinds both drivers */
+	KUNIT_ASSERT_EQ(test, of_overlay_apply_kunit(test, leds_keys_kunit), 0);
+	leds_keys_bound(test, "/gpio-sim-kunit");
+	leds_keys_bound(test, "/leds-kunit");
+	leds_keys_bound(test, "/hellokeys-kunit");
+	leds_keys_chip(test, "/gpio-sim-kunit/bank0", ctx->led_chip);
+	leds_keys_chip(test, "/gpio-sim-kunit/bank1", ctx->key_chip);
+	return 0;
+}
+
+static void leds_keys_test_led_node(struct kunit *test){
+	struct leds_keys_ctx *ctx = test->priv;
+	struct file *file;
+	char rec[4];
+	loff_t pos;
+
+	file = leds_keys_open(test, "/dev/kunit_red", O_RDWR | O_NONBLOCK);
+
+	KUNIT_EXPECT_EQ(test, leds_keys_write(test, file, "1", 1), 1);
+	KUNIT_EXPECT_EQ(test, leds_keys_wait_line(ctx->led_chip, 0, 1), 1);
+	KUNIT_EXPECT_EQ(test, leds_keys_write(test, file, "0", 1), 1);
+	KUNIT_EXPECT_EQ(test, leds_keys_wait_line(ctx->led_chip, 0, 0), 0);
+	KUNIT_EXPECT_EQ(test, leds_keys_write(test, file, "x", 1), -EINVAL);
+
+	/* the first read of a file returns the state, the rest of the file is EOF */
+	pos = 0;
+	KUNIT_EXPECT_EQ(test, leds_keys_read(test, file, rec, sizeof(rec), &pos), 2);
+	KUNIT_EXPECT_MEMEQ(test, rec, "0\n", 2);
+	KUNIT_EXPECT_EQ(test, leds_keys_read(test, file, rec, sizeof(rec), &pos), 0);
+
+	/* at offset 0 again a state already seen is not returned, a change is */
+	pos = 0;
+	KUNIT_EXPECT_EQ(test, leds_keys_read(test, file, rec, sizeof(rec), &pos), -EAGAIN);
+	KUNIT_EXPECT_EQ(test, leds_keys_write(test, file, "1", 1), 1);
+	KUNIT_EXPECT_EQ(test, leds_keys_read(test, file, rec, sizeof(rec), &pos), 2);
+	KUNIT_EXPECT_MEMEQ(test, rec, "1\n", 2);
+	KUNIT_EXPECT_EQ(test, leds_keys_write(test, file, "0", 1), 1);
+}
+
+static void leds_keys_test_frame(struct kunit *test){
+	struct leds_keys_ctx *ctx = test->priv;
+	struct file *file;
+	u32 frame;
+	int line, want;
+
+	/* one bank in the overlay, bit n is line n */
+	file = leds_keys_open(test, "/dev/rgbleds", O_RDWR);
+	for (frame = 0; frame < 8; frame++){
+		KUNIT_EXPECT_EQ(test, leds_keys_write(test, file, &frame, sizeof(frame)), sizeof(frame));
+		for (line = 0; line < 3; line++){
+			want = !!(frame & BIT(line));
+			KUNIT_EXPECT_EQ_MSG(test, leds_keys_wait_line(ctx->led_chip, line, want), want,
+					    "frame %#x line %d", frame, line);
+		}
+	}
+	frame = 0;
+	KUNIT_EXPECT_EQ(test, leds_keys_write(test, file, &frame, sizeof(frame)), sizeof(frame));
+
+	/* a frame size other than the number of banks is refused */
+	KUNIT_EXPECT_EQ(test, leds_keys_write(test, file, &frame, 2), -EINVAL);
+}
+
+/* lines start pulled down (all keys pressed), release them and forget those events */
+static struct file *leds_keys_open_keys(struct kunit *test){
+	struct file *file;
+	int line;
+
+	file = leds_keys_open(test, "/dev/hellokeys", O_RDONLY | O_NONBLOCK);
+	for (line = 0; line < 3; line++)
+		KUNIT_ASSERT_EQ(test, leds_keys_pull(test, line, false), 0);
+	msleep(100);
+	leds_keys_drain(test, file);
+	return file;
+}
+
+static void leds_keys_test_key_events(struct kunit *test){
+	struct hellokeys_event press, release;
+	struct file *file;
+	u64 t0, t1, t2;
+
+	file = leds_keys_open_keys(test);
+
+	t0 = ktime_get_ns();
+	KUNIT_ASSERT_EQ(test, leds_keys_pull(test, 0, true), 0);
+	KUNIT_ASSERT_EQ(test, leds_keys_event(test, file, &press), 0);
+	t1 = ktime_get_ns();
+	KUNIT_EXPECT_EQ(test, press.key, 0);
+	KUNIT_EXPECT_EQ(test, press.edge, HELLOKEYS_EDGE_PRESS);
+	KUNIT_EXPECT_GE(test, press.timestamp_ns, t0);
+	KUNIT_EXPECT_LE(test, press.timestamp_ns, t1);
+
+	KUNIT_ASSERT_EQ(test, leds_keys_pull(test, 0, false), 0);
+	KUNIT_ASSERT_EQ(test, leds_keys_event(test, file, &release), 0);
+	t2 = ktime_get_ns();
+	KUNIT_EXPECT_EQ(test, release.key, 0);
+	KUNIT_EXPECT_EQ(test, release.edge, HELLOKEYS_EDGE_RELEASE);
+	KUNIT_EXPECT_GE(test, release.timestamp_ns, t1);
+	KUNIT_EXPECT_LE(test, release.timestamp_ns, t2);
+	KUNIT_EXPECT_GT(test, release.timestamp_ns, press.timestamp_ns);
+
+	/* nothing else was queued */
+	KUNIT_EXPECT_EQ(test, leds_keys_event(test, file, &press), -ETIMEDOUT);
+}
+
+/* LEB128, returns the bytes used or 0 */
+static size_t leds_keys_varint(const u8 *p, size_t n, u64 *value){
+	size_t i;
+
+	*value = 0;
+	for (i = 0; i < n && i < 10; i++){
+		*value |= (u64)(p[i] & 0x7f) << (7 * i);
+		if (!(p[i] & 0x80))
+			return i + 1;
+	}
+	return 0;
+}
+
+static void leds_keys_test_capture(struct kunit *test){
+	struct hellokeys_event ev;
+	struct file *keys, *file;
+	u64 t0, t1, time = 0, dt, lost;
+	int i, edges = 0, level[2] = { -1, -1 };
+	size_t have = 0, off, len;
+	loff_t pos = 0;
+	ssize_t ret;
+	u8 *buf;
+
+	buf = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+	keys = leds_keys_open_keys(test);
+	file = leds_keys_open(test, "/dev/hellokeys_capture", O_RDONLY | O_NONBLOCK);
+	while (leds_keys_read(test, file, buf, PAGE_SIZE, &pos) > 0)
+		;
+
+	/* gpio-sim lines have no RIO block behind them */
+	KUNIT_EXPECT_EQ(test, leds_keys_write_attr(LEDS_KEYS_CAPTURE_ATTR "sample_rate", "1000"), -EOPNOTSUPP);
+
+	KUNIT_ASSERT_EQ(test, leds_keys_write_attr(LEDS_KEYS_CAPTURE_ATTR "capture_pins", "0x1"), 0);
+	t0 = ktime_get_ns();
+	for (i = 0; i < 2; i++){
+		KUNIT_ASSERT_EQ(test, leds_keys_pull(test, 0, !i), 0);
+		KUNIT_ASSERT_EQ(test, leds_keys_event(test, keys, &ev), 0);
+	}
+	t1 = ktime_get_ns();
+	KUNIT_ASSERT_EQ(test, leds_keys_write_attr(LEDS_KEYS_CAPTURE_ATTR "capture_pins", "0"), 0);
+
+	while (have < PAGE_SIZE){
+		ret = leds_keys_read(test, file, buf + have, PAGE_SIZE - have, &pos);
+		if (ret <= 0)
+			break;
+		have += ret;
+	}
+
+	/* the stream of a capture starts with a SYNC: tag, le64 time, varint of the lost records */
+	KUNIT_ASSERT_GE(test, have, 10);
+	KUNIT_ASSERT_EQ(test, buf[0], HELLOKEYS_REC_SYNC);
+	for (i = 0; i < 8; i++)
+		time |= (u64)buf[1 + i] << (8 * i);
+	len = leds_keys_varint(buf + 9, have - 9, &lost);
+	KUNIT_ASSERT_NE(test, len, 0);
+	KUNIT_EXPECT_EQ(test, lost, 0);
+	KUNIT_EXPECT_GE(test, time, t0);
+	KUNIT_EXPECT_LE(test, time, t1);
+
+	off = 9 + len;
+	while (off < have && edges < 2){
+		KUNIT_ASSERT_EQ(test, buf[off] & HELLOKEYS_REC_TYPE, HELLOKEYS_REC_EDGE);
+		len = leds_keys_varint(buf + off + 1, have - off - 1, &dt);
+		KUNIT_ASSERT_NE(test, len, 0);
+		time += dt;
+		KUNIT_EXPECT_EQ(test, buf[off] & HELLOKEYS_REC_KEY, 0);
+		KUNIT_EXPECT_GE(test, time, t0);
+		KUNIT_EXPECT_LE(test, time, t1);
+		level[edges++] = !!(buf[off] & HELLOKEYS_REC_LEVEL);
+		off += 1 + len;
+	}
+	/* raw levels: pulled down first, then up again */
+	KUNIT_EXPECT_EQ(test, level[0], 0);
+	KUNIT_EXPECT_EQ(test, level[1], 1);
+}
+
+static struct kunit_case leds_keys_cases[] = {
+	KUNIT_CASE(leds_keys_test_led_node),
+	KUNIT_CASE(leds_keys_test_frame),
+	KUNIT_CASE(leds_keys_test_key_events),
+	KUNIT_CASE(leds_keys_test_capture),
+	{}
+};
+
+static struct kunit_suite leds_keys_suite = {
+	.name = "leds_keys",
+	.init = leds_keys_init,
+	.test_cases = leds_keys_cases,
+};
+kunit_test_suite(leds_keys_suite);
+
+MODULE_SOFTDEP("pre: leds_driver hellokeys_rpi5");
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Balavignesh");
+MODULE_DESCRIPTION("KUnit tests of leds_driver and hellokeys on gpio-sim lines");
@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * tracepoints of leds_driver, one event per file operation with the time spent in the driver
+ *
+ *  echo 1 | sudo tee /sys/kernel/tracing/events/rgbleds/enable
+ *  sudo cat /sys/kernel/tracing/trace_pipe
+ *  or: sudo perf trace -e 'rgbleds:*'
+ *
+ * name is the LED (or "rgbleds" for the frame node), value the brightness of the LED after the
+ * operation (frame node: bank 0 of the frame), ret what the fop returned.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rgbleds
+
+#if !defined(_LEDS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LEDS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(rgbleds_op,
+
+	TP_PROTO(const char *name, u32 value, long ret, u64 duration_ns),
+
+	TP_ARGS(name, value, ret, duration_ns),
+
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(u32, value)
+		__field(long, ret)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(name);
+		__entry->value = value;
+		__entry->ret = ret;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("%s value=%#x ret=%ld duration=%llu ns", __get_str(name), __entry->value, __entry->ret,
+		  __entry->duration_ns)
+);
+
+DEFINE_EVENT(rgbleds_op, rgbleds_led_write,
+	TP_PROTO(const char *name, u32 value, long ret, u64 duration_ns),
+	TP_ARGS(name, value, ret, duration_ns));
+
+DEFINE_EVENT(rgbleds_op, rgbleds_led_read,
+	TP_PROTO(const char *name, u32 value, long ret, u64 duration_ns),
+	TP_ARGS(name, value, ret, duration_ns));
+
+DEFINE_EVENT(rgbleds_op, rgbleds_frame_write,
+	TP_PROTO(const char *name, u32 value, long ret, u64 duration_ns),
+	TP_ARGS(name, value, ret, duration_ns));
+
+DEFINE_EVENT(rgbleds_op, rgbleds_frame_read,
+	TP_PROTO(const char *name, u32 value, long ret, u64 duration_ns),
+	TP_ARGS(name, value, ret, duration_ns));
+
+DEFINE_EVENT(rgbleds_op, rgbleds_ioctl,
+	TP_PROTO(const char *name, u32 value, long ret, u64 duration_ns),
+	TP_ARGS(name, value, ret, duration_ns));
+
+#endif /* _LEDS_TRACE_H */
+
+/* the header is not in include/trace/events, define_trace.h has to find it next to the driver */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE leds_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace ABI of leds_driver, shared between the driver and the apps in apps/
+ */
+#ifndef _RGBLEDS_H
+#define _RGBLEDS_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Frames on /dev/rgbleds
+ *
+ * the LEDs are grouped in banks of 32 pins of one GPIO controller, a frame is one __u32 per
+ * bank in the order the banks first appear in the DT, bit n of a word is pin (32 * bank + n)
+ * of that controller. writes and reads of /dev/rgbleds always carry the whole frame.
+ */
+#define RGBLEDS_MAX_BANKS	8
+
+/*
+ * Batched write on /dev/ledred, /dev/ledgreen, /dev/ledblue
+ *
+ * one write() carries a header followed by header.count entries, the driver plays them
+ * back in order: set the LED to entry.state, then wait entry.delay_us before the next one.
+ * a write which does not start with LED_SEQ_MAGIC is the old '0'/'1' ASCII format.
+ */
+#define LED_SEQ_MAGIC		0x5145534cU	/* "LSEQ" in memory on little endian */
+#define LED_SEQ_MAX_ENTRIES	1024
+
+struct led_seq_header {
+	__u32 magic;
+	__u32 count;
+};
+
+struct led_seq_entry {
+	__u32 state;		/* 0 = off, anything else = on */
+	__u32 delay_us;		/* time to hold this state */
+};
+
+/*
+ * Patterns on /dev/rgbleds
+ *
+ * a pattern is uploaded once as an array of keyframes and then played by the driver from a
+ * timer, the LEDs keep running it without any further syscall. the driver keeps
+ * LED_PATTERN_SLOTS patterns in a ring, an upload replaces the pattern with the same name or
+ * else the oldest slot, and returns the slot id which is later used to play it.
+ */
+#define LED_PATTERN_NAME_LEN	16
+#define LED_PATTERN_MAX_FRAMES	64
+#define LED_PATTERN_SLOTS	8
+#define LED_PATTERN_BANKS	2	/* a keyframe covers the first two banks of the frame */
+
+struct rgbleds_keyframe {
+	__u32 frame[LED_PATTERN_BANKS];	/* LEDs which are on, same layout as a /dev/rgbleds frame */
+	__u8 brightness;	/* brightness of those LEDs, 0 means fully on */
+	__u8 pad[3];
+	__u32 hold_ms;		/* time until the next keyframe, at least 1 */
+};
+
+struct rgbleds_pattern {
+	char name[LED_PATTERN_NAME_LEN];
+	__u32 count;		/* number of keyframes used */
+	__u32 repeat;		/* number of passes, 0 loops until stopped */
+	struct rgbleds_keyframe frames[LED_PATTERN_MAX_FRAMES];
+};
+
+#define RGBLEDS_IOC_MAGIC		'L'
+#define RGBLEDS_IOC_PATTERN_UPLOAD	_IOW(RGBLEDS_IOC_MAGIC, 1, struct rgbleds_pattern)	/* returns the slot id */
+#define RGBLEDS_IOC_PATTERN_PLAY	_IOW(RGBLEDS_IOC_MAGIC, 2, __u32)
+#define RGBLEDS_IOC_PATTERN_STOP	_IO(RGBLEDS_IOC_MAGIC, 3)
+
+/*
+ * io_uring passthrough (IORING_OP_URING_CMD) on /dev/rgbleds and /dev/ledX
+ *
+ * sqe->cmd_op is a RGBLEDS_IOC_* command with the ioctl argument in arg, or one of the
+ * RGBLEDS_UCMD_* below with its data inline in the sqe command area (struct rgbleds_uring_cmd),
+ * so an LED update needs no extra user memory. cqe->res is what the ioctl / write would return
+ * without the byte count: the result of the ioctl, or 0 / -errno.
+ *  - RGBLEDS_UCMD_FRAME (/dev/rgbleds): one frame, like a write(). a normal 64 byte sqe carries
+ *    RGBLEDS_UCMD_SQE_BANKS banks, more banks need a ring set up with IORING_SETUP_SQE128
+ *  - RGBLEDS_UCMD_BRIGHTNESS (/dev/ledX): brightness 0..255 of that LED
+ *  - RGBLEDS_UCMD_PATTERN_PLAY (/dev/rgbleds): RGBLEDS_IOC_PATTERN_PLAY with the slot id inline
+ *    instead of behind a pointer, so it completes without touching user memory
+ */
+#define RGBLEDS_UCMD_SQE_BANKS		4
+#define RGBLEDS_UCMD_FRAME		_IOW(RGBLEDS_IOC_MAGIC, 0x80, __u32[RGBLEDS_MAX_BANKS])
+#define RGBLEDS_UCMD_BRIGHTNESS		_IOW(RGBLEDS_IOC_MAGIC, 0x81, __u32)
+#define RGBLEDS_UCMD_PATTERN_PLAY	_IOW(RGBLEDS_IOC_MAGIC, 0x82, __u32)
+
+struct rgbleds_uring_cmd {
+	union {
+		__u64 arg;				/* RGBLEDS_IOC_* */
+		__u32 frame[RGBLEDS_MAX_BANKS];		/* RGBLEDS_UCMD_FRAME */
+		__u32 brightness;			/* RGBLEDS_UCMD_BRIGHTNESS */
+		__u32 pattern_id;			/* RGBLEDS_UCMD_PATTERN_PLAY */
+	};
+};
+
+/*
+ * Shared state page, mmap() of /dev/rgbleds
+ *
+ * the page holds the wanted state of every LED (index = order of the LED nodes in the DT),
+ * the driver looks at it from a timer every tick and applies changes
+ * with one pin update. seq works like a seqcount: make it odd, update leds[], then make it
+ * even again with a release store. the driver skips odd or torn snapshots and reports the
+ * last applied seq in applied_seq.
+ */
+#define RGBLEDS_SHM_MAX_LEDS	1024
+
+struct rgbleds_shm_led {
+	__u8 on;
+	__u8 brightness;	/* 0 means fully on */
+};
+
+struct rgbleds_shm {
+	__u32 seq;
+	__u32 applied_seq;
+	struct rgbleds_shm_led leds[RGBLEDS_SHM_MAX_LEDS];
+};
+
+#endif /* _RGBLEDS_H */